@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Many producer threads drive one System without locking it: submit() pushes a command on a lock-free stack
+// and a single applier thread takes the whole stack at once, reverses it and applies the batch in submission order
+// Commands of one submitter are applied in the order they were submitted, each Ticket gets the result of its own command
+class CommandApplier
+{
+public:
+	struct Result
+	{
+		std::optional<ProcessID> runningProcess; // On the current CPU after the command, none when idle
+		std::string error; // Empty if the command succeeded
+		uint64_t sequence{0}; // Position of the command among every applied command
+	};
+
+private:
+	struct Command // Shared by its Ticket and the applier, the last one done with it frees it
+	{
+		std::vector<std::string> tokens; // Empty for the stop command
+		Command* next{nullptr};
+		Result result{};
+		std::atomic<bool> isDone{false};
+		std::atomic<uint8_t> owners{2};
+	};
+
+	static void release(Command* command) noexcept
+	{
+		if (command->owners.fetch_sub(1, std::memory_order_acq_rel) == 1) delete command;
+	}
+
+public:
+	class Ticket // Result of one submitted command
+	{
+	public:
+		Ticket(Ticket&& other) noexcept : command{std::exchange(other.command, nullptr)} {}
+		Ticket& operator=(Ticket&& other) noexcept
+		{
+			if (this != &other)
+			{
+				if (command) release(command);
+				command = std::exchange(other.command, nullptr);
+			}
+			return *this;
+		}
+		~Ticket()
+		{
+			if (command) release(command);
+		}
+
+		[[nodiscard]] const Result& wait() const
+		{
+			command->isDone.wait(false, std::memory_order_acquire);
+			return command->result;
+		}
+
+	private:
+		friend class CommandApplier;
+		explicit Ticket(Command* inCommand) : command{inCommand} {}
+
+		Command* command;
+	};
+
+	explicit CommandApplier(System& inSystem) :
+		system{inSystem}
+		, commandMap{getCommandMap()}
+		, head{nullptr}
+		, appliedCount{0}
+		, batchCount{0}
+		, applier{[this]{ apply(); }}
+	{}
+
+	~CommandApplier() // Submitters must be done submitting
+	{
+		const auto stopTicket = push(std::vector<std::string>{});
+		applier.join();
+	}
+
+	CommandApplier(const CommandApplier&) = delete;
+	CommandApplier& operator=(const CommandApplier&) = delete;
+
+	[[nodiscard]] Ticket submit(std::vector<std::string> tokens) // Any thread, tokens == {command, [argument1, argument2, ...]}
+	{
+		if (tokens.empty()) throw std::runtime_error{"Invalid command."};
+		return push(std::move(tokens));
+	}
+
+	[[nodiscard]] uint64_t getBatchCount() const noexcept { return batchCount.load(std::memory_order_relaxed); } // Times the applier drained the stack
+
+private:
+	[[nodiscard]] Ticket push(std::vector<std::string> tokens)
+	{
+		auto* command = new Command{};
+		command->tokens = std::move(tokens);
+		auto ticket = Ticket{command}; // Before the applier can see the command
+		command->next = head.load(std::memory_order_relaxed);
+		while (!head.compare_exchange_weak(command->next, command, std::memory_order_release, std::memory_order_relaxed)) {}
+		head.notify_one();
+		return ticket;
+	}
+
+	void apply() // Applier thread
+	{
+		while (true)
+		{
+			auto* stack = head.exchange(nullptr, std::memory_order_acquire);
+			if (stack == nullptr)
+			{
+				head.wait(nullptr, std::memory_order_acquire);
+				continue;
+			}
+			batchCount.fetch_add(1, std::memory_order_relaxed);
+			auto* batch = static_cast<Command*>(nullptr); // Newest first on the stack, reversed into submission order
+			while (stack != nullptr)
+			{
+				auto* next = stack->next;
+				stack->next = batch;
+				batch = stack;
+				stack = next;
+			}
+			auto isStopping = false;
+			for (auto* command = batch; command != nullptr;)
+			{
+				auto* next = command->next;
+				if (command->tokens.empty()) isStopping = true;
+				else run(*command);
+				command->isDone.store(true, std::memory_order_release);
+				command->isDone.notify_all();
+				release(command);
+				command = next;
+			}
+			if (isStopping) return;
+		}
+	}
+
+	void run(Command& command)
+	{
+		auto& result = command.result;
+		result.sequence = appliedCount++;
+		try
+		{
+			const auto iterPair = commandMap.find(command.tokens.front());
+			if (iterPair == commandMap.end()) throw std::runtime_error{"Invalid command."};
+			iterPair->second(system, std::vector<std::string>(command.tokens.begin() + 1, command.tokens.end()));
+		}
+		catch (const std::exception& error) // std::invalid_argument of a malformed number too
+		{
+			result.error = error.what();
+		}
+		result.runningProcess = system.getRunningProcess(system.getCurrentCpu());
+	}
+
+	System& system;
+	std::unordered_map<std::string, CommandFunction> commandMap; // Only read by the applier
+	std::atomic<Command*> head; // Stack of submitted commands, newest first
+	uint64_t appliedCount; // Only touched by the applier
+	std::atomic<uint64_t> batchCount;
+	std::thread applier; // Last, everything above is ready when it starts
+};
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Execution mode: every live process is a coroutine running a small workload, and after every command the running process
+// of each simulated CPU is really resumed for one quantum on the host thread of that CPU
+// Resource units are counting semaphores: units a process gets are acquired by its coroutine's next quantum, released units go back at once
+// Commands added to the shell:
+//	ex <iterations>: turn the mode on, a quantum is <iterations> rounds of the workload. ex 0 prints the measures and turns it off
+class ProcessExecutor
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Statistics
+	{
+		uint64_t dispatches{0};
+		uint64_t contextSwitches{0}; // A CPU resumed another process than on its previous dispatch
+		uint64_t migrations{0}; // A process resumed on another host thread than the last time
+		Clock::duration dispatchLatency{}; // Submission to the start of the quantum, summed
+		Clock::duration runTime{}; // Quanta, summed
+		Clock::duration semaphoreWait{}; // Time spent acquiring units, summed
+	};
+
+	ProcessExecutor() :
+		iterations{0}
+		, slots{}
+		, semaphores{}
+		, workers{}
+		, lastDispatched{}
+		, statistics{}
+	{
+		for (uint32_t resource = 0; resource < ResourceID::MAX_EXCLUSIVE; resource++) semaphores[resource] = std::make_unique<std::counting_semaphore<>>(unitMap[resource]);
+	}
+
+	~ProcessExecutor()
+	{
+		stop();
+	}
+
+	ProcessExecutor(const ProcessExecutor&) = delete;
+	ProcessExecutor& operator=(const ProcessExecutor&) = delete;
+
+	void attach(Shell& shell)
+	{
+		shell.registerCommand("ex", [this, &shell](System&, const std::vector<std::string>& arguments)
+		{
+			setIterations(arguments);
+			if (isEnabled()) shell.setCommandHook([this](System& system){ dispatch(system); });
+			else shell.setCommandHook({}); // No hook while off, so the batch mode can memoize its replays
+		});
+	}
+
+	void setIterations(const std::vector<std::string>& arguments)
+	{
+		checkArgumentSize(arguments, 1);
+		const auto maybeIterations = std::stof(arguments.front());
+		if (maybeIterations < 0 || maybeIterations - std::floor(maybeIterations) != 0) throw std::runtime_error{"Invalid number of iterations."};
+		iterations = static_cast<uint32_t>(maybeIterations);
+		if (iterations != 0) return;
+		writeStatistics(std::cout);
+		stop();
+	}
+
+	[[nodiscard]] bool isEnabled() const noexcept { return iterations != 0; }
+	[[nodiscard]] const Statistics& getStatistics() const noexcept { return statistics; }
+
+	void dispatch(const System& system) // Bring the coroutines and semaphores in line with the system, then run one quantum on every busy CPU
+	{
+		reconcile(system);
+		while (workers.size() < system.getCpuCount()) workers.push_back(std::make_unique<Worker>(*this, static_cast<uint32_t>(workers.size())));
+
+		auto jobs = std::vector<std::pair<uint32_t, ProcessID>>{}; // {cpu, process}
+		for (uint32_t cpu = 0; cpu < system.getCpuCount(); cpu++)
+		{
+			const auto process = system.getRunningProcess(cpu);
+			if (process.has_value()) jobs.push_back({cpu, process.value()});
+		}
+		auto done = std::latch{static_cast<ptrdiff_t>(jobs.size())};
+		for (const auto& [cpu, process] : jobs)
+		{
+			if (lastDispatched[cpu].has_value() && lastDispatched[cpu].value() != process) statistics.contextSwitches++;
+			lastDispatched[cpu] = process;
+			workers[cpu]->submit(Job{process, Clock::now(), &done});
+		}
+		done.wait(); // Keep the simulation and the quanta in lockstep, no command runs while a coroutine does
+		for (const auto& worker : workers) worker->collect(statistics);
+	}
+
+	void writeStatistics(std::ostream& output) const
+	{
+		const auto toNanoseconds = [this](Clock::duration duration)
+		{
+			return statistics.dispatches == 0 ? 0 : std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / static_cast<int64_t>(statistics.dispatches);
+		};
+		output << "dispatches " << statistics.dispatches
+			<< ", context switches " << statistics.contextSwitches
+			<< ", migrations " << statistics.migrations
+			<< ", mean dispatch latency " << toNanoseconds(statistics.dispatchLatency) << " ns"
+			<< ", mean quantum " << toNanoseconds(statistics.runTime) << " ns"
+			<< ", mean semaphore wait " << toNanoseconds(statistics.semaphoreWait) << " ns\n";
+	}
+
+private:
+	class Workload // Coroutine of one process, suspended between quanta
+	{
+	public:
+		struct promise_type
+		{
+			Workload get_return_object() { return Workload{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_always final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+
+		explicit Workload(std::coroutine_handle<promise_type> inHandle) : handle{inHandle} {}
+		Workload(Workload&& other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+		Workload& operator=(Workload&& other) noexcept
+		{
+			if (this != &other)
+			{
+				if (handle) handle.destroy();
+				handle = std::exchange(other.handle, nullptr);
+			}
+			return *this;
+		}
+		~Workload() { if (handle) handle.destroy(); }
+
+		void resume() const { handle.resume(); }
+
+	private:
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	struct ProcessSlot
+	{
+		std::optional<Workload> workload;
+		std::array<Units, ResourceID::MAX_EXCLUSIVE> acquired{}; // Units the coroutine holds on the semaphores
+		std::array<Units, ResourceID::MAX_EXCLUSIVE> toAcquire{}; // Granted by the system, acquired by the next quantum
+		std::optional<uint32_t> lastCpu;
+		uint64_t sink{0}; // Keeps the workload from being optimized away
+	};
+
+	struct Job
+	{
+		ProcessID process;
+		Clock::time_point submitted;
+		std::latch* done;
+	};
+
+	class Worker // Host thread of one simulated CPU
+	{
+	public:
+		Worker(ProcessExecutor& inExecutor, uint32_t inCpu) :
+			executor{inExecutor}
+			, cpu{inCpu}
+			, job{}
+			, isStopping{false}
+			, local{}
+			, thread{[this]{ run(); }}
+		{}
+
+		~Worker()
+		{
+			{
+				auto lock = std::lock_guard{mutex};
+				isStopping = true;
+			}
+			condition.notify_one();
+			thread.join();
+		}
+
+		void submit(Job inJob)
+		{
+			{
+				auto lock = std::lock_guard{mutex};
+				job = inJob;
+			}
+			condition.notify_one();
+		}
+
+		void collect(Statistics& statistics) // Only called while the worker is idle
+		{
+			auto lock = std::lock_guard{mutex};
+			statistics.dispatches += std::exchange(local.dispatches, 0);
+			statistics.migrations += std::exchange(local.migrations, 0);
+			statistics.dispatchLatency += std::exchange(local.dispatchLatency, {});
+			statistics.runTime += std::exchange(local.runTime, {});
+			statistics.semaphoreWait += std::exchange(local.semaphoreWait, {});
+		}
+
+	private:
+		void run()
+		{
+			while (true)
+			{
+				auto lock = std::unique_lock{mutex};
+				condition.wait(lock, [this]{ return isStopping || job.has_value(); });
+				if (isStopping) return;
+				const auto current = std::exchange(job, std::nullopt).value();
+				execute(current);
+				lock.unlock();
+				current.done->count_down();
+			}
+		}
+
+		void execute(const Job& current)
+		{
+			const auto start = Clock::now();
+			local.dispatchLatency += start - current.submitted;
+			auto& slot = executor.slots[current.process];
+			if (slot.lastCpu.has_value() && slot.lastCpu.value() != cpu) local.migrations++;
+			slot.lastCpu = cpu;
+			for (uint32_t resource = 0; resource < ResourceID::MAX_EXCLUSIVE; resource++) // Real acquisition of the units granted since the last quantum
+			{
+				for (; slot.toAcquire[resource] != 0; slot.toAcquire[resource]--)
+				{
+					executor.semaphores[resource]->acquire();
+					slot.acquired[resource]++;
+				}
+			}
+			const auto acquired = Clock::now();
+			local.semaphoreWait += acquired - start;
+			slot.workload->resume();
+			local.runTime += Clock::now() - acquired;
+			local.dispatches++;
+		}
+
+		ProcessExecutor& executor;
+		uint32_t cpu;
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::optional<Job> job;
+		bool isStopping;
+		Statistics local;
+		std::thread thread; // Last, everything above is ready when it starts
+	};
+
+	[[nodiscard]] static Workload runWorkload(const uint32_t& iterations, uint64_t& sink, uint64_t seed)
+	{
+		auto state = seed * 0x9E3779B97F4A7C15ULL | 1;
+		while (true)
+		{
+			for (uint32_t i = 0; i < iterations; i++) // xorshift64
+			{
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+			}
+			sink = state;
+			co_await std::suspend_always{};
+		}
+	}
+
+	void reconcile(const System& system) // Spawn and destroy coroutines, release the units the system took back and schedule the acquisition of new ones
+	{
+		const auto& processes = system.getProcesses();
+		for (uint32_t process = 0; process < ProcessID::MAX_EXCLUSIVE; process++)
+		{
+			const auto pcb = processes[process];
+			auto& slot = slots[process];
+			auto held = std::array<Units, ResourceID::MAX_EXCLUSIVE>{};
+			for (const auto& [resource, units] : pcb.resources) held[resource] = units;
+
+			for (uint32_t resource = 0; resource < ResourceID::MAX_EXCLUSIVE; resource++)
+			{
+				auto& acquired = slot.acquired[resource];
+				if (acquired > held[resource])
+				{
+					semaphores[resource]->release(acquired - held[resource]);
+					acquired = held[resource];
+				}
+				slot.toAcquire[resource] = held[resource] - acquired;
+			}
+
+			if (pcb.state == PCB::State::Free) slot.workload.reset();
+			else if (!slot.workload.has_value()) slot.workload.emplace(runWorkload(iterations, slot.sink, process + 1));
+		}
+	}
+
+	void stop() // Join the threads, release every unit and drop the coroutines
+	{
+		workers.clear();
+		for (auto& slot : slots)
+		{
+			for (uint32_t resource = 0; resource < ResourceID::MAX_EXCLUSIVE; resource++)
+			{
+				if (slot.acquired[resource] != 0) semaphores[resource]->release(slot.acquired[resource]);
+			}
+			slot = ProcessSlot{};
+		}
+		lastDispatched = {};
+		statistics = {};
+	}
+
+	uint32_t iterations; // Per quantum, 0 when the mode is off
+	std::array<ProcessSlot, ProcessID::MAX_EXCLUSIVE> slots;
+	std::array<std::unique_ptr<std::counting_semaphore<>>, ResourceID::MAX_EXCLUSIVE> semaphores; // Initialized with the inventory of every resource
+	std::vector<std::unique_ptr<Worker>> workers; // Indexed by CPU
+	std::array<std::optional<ProcessID>, System::maxCpus> lastDispatched; // Per CPU
+	Statistics statistics;
+};
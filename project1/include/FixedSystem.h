@@ -0,0 +1,332 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <type_traits>
+
+// System with its sizes fixed at compile time: the basic commands (in, cr, de, rq, rl, to) on one CPU, fifo waitLists and no priority protocol,
+// answering like System does with the same settings. Every operation is constexpr, so a whole trace can be evaluated at compile time
+// Nothing allocates and every index is stored in the narrowest unsigned type that fits, System<16, 4, 3> fits in 6 cache lines
+// Constant evaluation can't throw: a rejected command returns false and changes nothing, where System throws before modifying anything
+// Numbers are plain decimals, and the other commands (wq, pi, cpus, cpu, rq of several resources) are rejected
+namespace fixed
+{
+	template<uint64_t Max>
+	using Narrowest = std::conditional_t<Max <= std::numeric_limits<uint8_t>::max(), uint8_t,
+		std::conditional_t<Max <= std::numeric_limits<uint16_t>::max(), uint16_t, uint32_t>>;
+
+	template<typename T, size_t Capacity>
+	class InlineQueue // FIFO stored inline, erasing keeps the order. Capacities are a few entries, shifting beats a ring
+	{
+	public:
+		using Size = Narrowest<Capacity>;
+
+		[[nodiscard]] constexpr const T* begin() const noexcept { return items.data(); }
+		[[nodiscard]] constexpr const T* end() const noexcept { return items.data() + count; }
+		[[nodiscard]] constexpr Size size() const noexcept { return count; }
+		[[nodiscard]] constexpr bool empty() const noexcept { return count == 0; }
+		[[nodiscard]] constexpr T front() const noexcept { return items[0]; }
+
+		constexpr void push_back(T item) noexcept { items[count++] = item; }
+		constexpr void pop_front() noexcept { erase(0); }
+		constexpr void clear() noexcept { count = 0; }
+
+		constexpr bool remove(T item) noexcept // False if it isn't there
+		{
+			for (Size i = 0; i < count; i++)
+			{
+				if (items[i] != item) continue;
+				erase(i);
+				return true;
+			}
+			return false;
+		}
+
+	private:
+		constexpr void erase(Size index) noexcept
+		{
+			for (auto i = index; i + 1 < count; i++) items[i] = items[i + 1];
+			count--;
+		}
+
+		std::array<T, Capacity> items{};
+		Size count{0};
+	};
+
+	template<uint32_t Procs, uint32_t Resources, uint32_t Levels>
+	class System
+	{
+		static_assert(Procs >= 2 && Resources >= 1 && Levels >= 1, "Process 0 and at least one process, resource and level");
+
+	public:
+		using Process = Narrowest<Procs>; // Procs stands for none
+		using Resource = Narrowest<Resources>;
+		using Level = Narrowest<Levels>;
+		using Units = uint8_t;
+
+		enum class State : uint8_t {Free, Ready, Blocked};
+
+		static constexpr Process none = Procs;
+
+		constexpr explicit System(const std::array<Units, Resources>& inInventory) noexcept :
+			inventory{inInventory}
+		{
+			init();
+		}
+
+		constexpr void init() noexcept
+		{
+			rows = {};
+			held = {};
+			heldOrder = {};
+			readyLists = {};
+			waitLists = {};
+			remain = inventory;
+			readyProcess(0);
+		}
+
+		[[nodiscard]] constexpr bool create(uint32_t priority) noexcept
+		{
+			if (priority >= Levels) return false;
+			auto freeProcess = Process{0};
+			while (freeProcess < Procs && rows[freeProcess].state != State::Free) freeProcess++;
+			if (freeProcess == Procs) return false;
+			const auto parent = getRunningProcess();
+			rows[freeProcess] = Row{};
+			rows[freeProcess].priority = static_cast<Level>(priority);
+			rows[freeProcess].parent = parent;
+			if (rows[parent].lastChild == none) rows[parent].firstChild = freeProcess; // Childs in creation order, like the child list of a PCB
+			else rows[rows[parent].lastChild].nextSibling = freeProcess;
+			rows[parent].lastChild = freeProcess;
+			readyProcess(freeProcess);
+			return true;
+		}
+
+		[[nodiscard]] constexpr bool destroy(uint32_t process) noexcept // The running process or one of its childs
+		{
+			if (process == 0 || process >= Procs) return false;
+			const auto running = getRunningProcess();
+			if (process != running && (rows[process].state == State::Free || rows[process].parent != running)) return false;
+			destroyProcess(static_cast<Process>(process));
+			return true;
+		}
+
+		[[nodiscard]] constexpr bool request(uint32_t resource, uint32_t units) noexcept
+		{
+			if (resource >= Resources || units == 0 || units > inventory[resource]) return false;
+			const auto process = getRunningProcess();
+			if (process == 0 || held[process][resource] == inventory[resource]) return false;
+			if (remain[resource] >= units)
+			{
+				grant(process, static_cast<Resource>(resource), static_cast<Units>(units));
+				return true;
+			}
+			readyLists[rows[process].priority].remove(process);
+			rows[process].state = State::Blocked;
+			rows[process].waitingUnits = static_cast<Units>(units);
+			waitLists[resource].push_back(process);
+			return true;
+		}
+
+		[[nodiscard]] constexpr bool release(uint32_t resource, uint32_t units) noexcept
+		{
+			if (resource >= Resources || units == 0 || units > inventory[resource]) return false;
+			const auto process = getRunningProcess();
+			if (held[process][resource] < units) return false; // Not held at all too
+			releaseUnits(process, static_cast<Resource>(resource), static_cast<Units>(units));
+			unblockProcesses(static_cast<Resource>(resource));
+			return true;
+		}
+
+		constexpr void timeout() noexcept
+		{
+			auto& list = readyLists[rows[getRunningProcess()].priority];
+			list.push_back(list.front());
+			list.pop_front();
+		}
+
+		[[nodiscard]] constexpr Process getRunningProcess() const noexcept // Process 0 is never blocked, some level always has a process
+		{
+			for (auto level = Levels; level-- != 0;)
+			{
+				if (!readyLists[level].empty()) return readyLists[level].front();
+			}
+			return none;
+		}
+
+		[[nodiscard]] constexpr int32_t runLine(std::string_view line) noexcept // Text command like the shell's, answers the running process or -1 if rejected
+		{
+			auto tokens = std::array<std::string_view, 4>{};
+			auto count = size_t{0};
+			constexpr auto whiteSpaces = std::string_view{" \t\r\v\f"};
+			for (auto begin = line.find_first_not_of(whiteSpaces); begin != std::string_view::npos; begin = line.find_first_not_of(whiteSpaces, begin))
+			{
+				const auto end = std::min(line.find_first_of(whiteSpaces, begin), line.size());
+				if (count == tokens.size()) return -1;
+				tokens[count++] = line.substr(begin, end - begin);
+				begin = end;
+			}
+			if (count == 0) return -1;
+
+			auto arguments = std::array<uint32_t, 2>{};
+			for (size_t i = 1; i < count; i++)
+			{
+				if (i > arguments.size() || !toNumber(tokens[i], arguments[i - 1])) return -1;
+			}
+			const auto command = tokens[0];
+			const auto argumentCount = count - 1;
+			auto isAccepted = false;
+			if (command == "in" && argumentCount == 0) { init(); isAccepted = true; }
+			else if (command == "to" && argumentCount == 0) { timeout(); isAccepted = true; }
+			else if (command == "cr" && argumentCount == 1) isAccepted = create(arguments[0]);
+			else if (command == "cr" && argumentCount == 2) isAccepted = arguments[1] == 0 && create(arguments[0]); // Pinned to the only CPU
+			else if (command == "de" && argumentCount == 1) isAccepted = destroy(arguments[0]);
+			else if (command == "rq" && argumentCount == 2) isAccepted = request(arguments[0], arguments[1]);
+			else if (command == "rl" && argumentCount == 2) isAccepted = release(arguments[0], arguments[1]);
+			return isAccepted ? static_cast<int32_t>(getRunningProcess()) : -1;
+		}
+
+		template<typename Function>
+		constexpr void runTrace(std::string_view trace, Function onAnswer) // onAnswer(int32_t) for every command line, blank lines skipped
+		{
+			while (!trace.empty())
+			{
+				const auto lineEnd = std::min(trace.find('\n'), trace.size());
+				const auto line = trace.substr(0, lineEnd);
+				trace.remove_prefix(std::min(lineEnd + 1, trace.size()));
+				if (line.find_first_not_of(" \t\r\v\f") != std::string_view::npos) onAnswer(runLine(line));
+			}
+		}
+
+		[[nodiscard]] constexpr State getState(uint32_t process) const noexcept { return rows[process].state; }
+		[[nodiscard]] constexpr Level getPriority(uint32_t process) const noexcept { return rows[process].priority; }
+		[[nodiscard]] constexpr Process getParent(uint32_t process) const noexcept { return rows[process].parent; }
+		[[nodiscard]] constexpr Units getHeldUnits(uint32_t process, uint32_t resource) const noexcept { return held[process][resource]; }
+		[[nodiscard]] constexpr Units getRemain(uint32_t resource) const noexcept { return remain[resource]; }
+		[[nodiscard]] constexpr const InlineQueue<Process, Procs>& getReadyList(uint32_t level) const noexcept { return readyLists[level]; }
+		[[nodiscard]] constexpr const InlineQueue<Process, Procs>& getWaitList(uint32_t resource) const noexcept { return waitLists[resource]; }
+
+	private:
+		struct Row
+		{
+			State state{State::Free};
+			Level priority{0};
+			Process parent{none};
+			Process firstChild{none};
+			Process lastChild{none};
+			Process nextSibling{none};
+			Units waitingUnits{0}; // While blocked, a process waits for one resource
+			Resource heldCount{0}; // Entries of heldOrder
+		};
+
+		[[nodiscard]] static constexpr bool toNumber(std::string_view token, uint32_t& value) noexcept // Decimal, a fraction of zeros is allowed like "2.0"
+		{
+			value = 0;
+			auto digits = size_t{0};
+			for (; digits < token.size() && token[digits] >= '0' && token[digits] <= '9'; digits++)
+			{
+				if (value > (std::numeric_limits<uint32_t>::max() - 9) / 10) return false;
+				value = value * 10 + static_cast<uint32_t>(token[digits] - '0');
+			}
+			if (digits == 0) return false;
+			if (digits == token.size()) return true;
+			if (token[digits] != '.') return false;
+			return token.find_first_not_of('0', digits + 1) == std::string_view::npos;
+		}
+
+		constexpr void readyProcess(Process process) noexcept
+		{
+			rows[process].state = State::Ready;
+			readyLists[rows[process].priority].push_back(process);
+		}
+
+		constexpr void grant(Process process, Resource resource, Units units) noexcept
+		{
+			if (held[process][resource] == 0) heldOrder[process][rows[process].heldCount++] = resource; // Held pairs in the order first owned
+			held[process][resource] += units;
+			remain[resource] -= units;
+		}
+
+		constexpr void releaseUnits(Process process, Resource resource, Units units) noexcept
+		{
+			held[process][resource] -= units;
+			remain[resource] += units;
+			if (held[process][resource] != 0) return;
+			auto& order = heldOrder[process];
+			auto& count = rows[process].heldCount;
+			auto i = Resource{0};
+			while (order[i] != resource) i++;
+			for (; i + 1 < count; i++) order[i] = order[i + 1];
+			count--;
+		}
+
+		constexpr void unblockProcesses(Resource resource) noexcept // Fifo, the head blocks everybody behind it
+		{
+			auto& waitList = waitLists[resource];
+			while (!waitList.empty() && remain[resource] != 0)
+			{
+				const auto waiter = waitList.front();
+				if (rows[waiter].waitingUnits > remain[resource]) break;
+				waitList.pop_front();
+				readyProcess(waiter);
+				grant(waiter, resource, rows[waiter].waitingUnits);
+				rows[waiter].waitingUnits = 0;
+			}
+		}
+
+		constexpr void destroyProcess(Process process) noexcept // Childs first in creation order, then the resources in the order they were owned
+		{
+			const auto parent = rows[process].parent;
+			if (parent != none) removeChild(parent, process);
+			for (auto child = rows[process].firstChild; child != none;)
+			{
+				const auto next = rows[child].nextSibling; // Destroying the child unlinks it
+				destroyProcess(child);
+				child = next;
+			}
+			while (rows[process].heldCount != 0)
+			{
+				const auto resource = heldOrder[process][0];
+				releaseUnits(process, resource, held[process][resource]);
+				unblockProcesses(resource);
+			}
+			if (rows[process].state == State::Ready) readyLists[rows[process].priority].remove(process);
+			else
+			{
+				for (auto& waitList : waitLists)
+				{
+					if (waitList.remove(process)) break;
+				}
+			}
+			rows[process] = Row{};
+		}
+
+		constexpr void removeChild(Process parent, Process child) noexcept
+		{
+			auto& row = rows[parent];
+			auto previous = none;
+			auto current = row.firstChild;
+			while (current != child)
+			{
+				previous = current;
+				current = rows[current].nextSibling;
+			}
+			const auto next = rows[child].nextSibling;
+			if (previous == none) row.firstChild = next;
+			else rows[previous].nextSibling = next;
+			if (row.lastChild == child) row.lastChild = previous;
+			rows[child].nextSibling = none;
+		}
+
+		std::array<Units, Resources> inventory;
+		std::array<Units, Resources> remain{};
+		std::array<Row, Procs> rows{};
+		std::array<std::array<Units, Resources>, Procs> held{};
+		std::array<std::array<Resource, Resources>, Procs> heldOrder{};
+		std::array<InlineQueue<Process, Procs>, Levels> readyLists{}; // The running process is at the head of the highest non empty level
+		std::array<InlineQueue<Process, Procs>, Resources> waitLists{};
+	};
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// What System reports after a command, as a fixed size record so sinks choose whether and how to format it
+struct Event
+{
+	enum class Kind : uint8_t
+	{
+		Created // {process}
+		, Destroyed // {count}
+		, Allocated // {units, resource}
+		, Released // {units, resource}
+		, Blocked // {process}
+		, Running // {process}
+		, Migrated // {process, from cpu, to cpu}
+		, CpuCount // {count}
+		, WaitDiscipline // {discipline}
+		, PriorityProtocol // {protocol}
+	};
+
+	Kind kind;
+	uint8_t first{0};
+	uint8_t second{0};
+	uint8_t third{0};
+};
+static_assert(sizeof(Event) == 4, "Binary records are 4 bytes");
+static_assert(ProcessID::MAX_EXCLUSIVE <= 256 && ResourceID::MAX_EXCLUSIVE <= 256, "Fields of an event are 8 bits");
+
+constexpr auto waitDisciplineNames = std::array<std::string_view, 4>{"fifo", "firstfit", "priority", "smallest"}; // Indexed by WaitDiscipline
+constexpr auto priorityProtocolNames = std::array<std::string_view, 3>{"none", "inheritance", "ceiling"}; // Indexed by PriorityProtocol
+
+namespace
+{
+	[[nodiscard]] inline char* appendText(char* output, std::string_view text) noexcept
+	{
+		for (const auto character : text) *output++ = character;
+		return output;
+	}
+
+	[[nodiscard]] inline char* appendNumber(char* output, uint32_t number) noexcept
+	{
+		return std::to_chars(output, output + 10, number).ptr;
+	}
+}
+
+constexpr size_t maxEventTextSize = 64; // Longest line formatEvent() writes, the newline included
+
+inline char* formatEvent(const Event& event, char* output) noexcept // Same text the shell always printed, returns the end
+{
+	switch (event.kind)
+	{
+		case Event::Kind::Created: output = appendNumber(appendText(output, "process "), event.first); output = appendText(output, " created"); break;
+		case Event::Kind::Destroyed: output = appendText(appendNumber(output, event.first), " processes destroyed"); break;
+		case Event::Kind::Allocated: output = appendText(appendNumber(appendText(appendNumber(output, event.first), " units of resource "), event.second), " allocated"); break;
+		case Event::Kind::Released: output = appendText(appendNumber(appendText(appendNumber(output, event.first), " units of resource "), event.second), " released"); break;
+		case Event::Kind::Blocked: output = appendText(appendNumber(appendText(output, "process "), event.first), " blocked"); break;
+		case Event::Kind::Running: output = appendText(appendNumber(appendText(output, "process "), event.first), " running"); break;
+		case Event::Kind::Migrated:
+			output = appendText(appendNumber(appendText(output, "process "), event.first), " migrated from cpu ");
+			output = appendNumber(appendText(appendNumber(output, event.second), " to cpu "), event.third);
+			break;
+		case Event::Kind::CpuCount: output = appendText(appendNumber(output, event.first), " cpus"); break;
+		case Event::Kind::WaitDiscipline: output = appendText(appendText(output, "wait discipline "), waitDisciplineNames[event.first]); break;
+		case Event::Kind::PriorityProtocol: output = appendText(appendText(output, "priority protocol "), priorityProtocolNames[event.first]); break;
+	}
+	*output++ = '\n';
+	return output;
+}
+
+class OutputSink // Where System reports its events
+{
+public:
+	virtual ~OutputSink() = default;
+	virtual void write(const Event& event) = 0;
+	virtual void flush() {}
+};
+
+class NullSink : public OutputSink // Drops everything, for replays that only need the running processes
+{
+public:
+	void write(const Event&) override {}
+};
+
+class StreamSink : public OutputSink // One line per event straight to the stream, the default on std::cout for the interactive shell
+{
+public:
+	explicit StreamSink(std::ostream& inOutput) : output{inOutput} {}
+
+	void write(const Event& event) override
+	{
+		auto line = std::array<char, maxEventTextSize>{};
+		const auto end = formatEvent(event, line.data());
+		output.write(line.data(), end - line.data());
+	}
+
+	void flush() override { output.flush(); }
+
+private:
+	std::ostream& output;
+};
+
+class BufferedTextSink : public OutputSink // Formats into a large buffer, the stream is only written when it fills up or on flush()
+{
+public:
+	explicit BufferedTextSink(std::ostream& inOutput, size_t capacity = 1 << 16) :
+		output{inOutput}
+		, buffer(std::max(capacity, maxEventTextSize))
+		, size{0}
+	{}
+
+	~BufferedTextSink() override { flush(); }
+
+	BufferedTextSink(const BufferedTextSink&) = delete;
+	BufferedTextSink& operator=(const BufferedTextSink&) = delete;
+
+	void write(const Event& event) override
+	{
+		if (buffer.size() - size < maxEventTextSize) flush();
+		size = formatEvent(event, buffer.data() + size) - buffer.data();
+	}
+
+	void flush() override
+	{
+		output.write(buffer.data(), static_cast<std::streamsize>(size));
+		size = 0;
+	}
+
+private:
+	std::ostream& output;
+	std::vector<char> buffer;
+	size_t size;
+};
+
+class BinarySink : public OutputSink // Raw 4 bytes records {kind, first, second, third}, buffered like BufferedTextSink
+{
+public:
+	explicit BinarySink(std::ostream& inOutput, size_t capacity = 1 << 14) :
+		output{inOutput}
+		, records{}
+	{
+		records.reserve(std::max(capacity, size_t{1}));
+	}
+
+	~BinarySink() override { flush(); }
+
+	BinarySink(const BinarySink&) = delete;
+	BinarySink& operator=(const BinarySink&) = delete;
+
+	void write(const Event& event) override
+	{
+		if (records.size() == records.capacity()) flush();
+		records.push_back(event);
+	}
+
+	void flush() override
+	{
+		output.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(Event)));
+		records.clear();
+	}
+
+private:
+	std::ostream& output;
+	std::vector<Event> records;
+};
@@ -4,11 +4,133 @@
 #include <cassert>
 #include <optional>
 #include <array>
+#include <span>
+#include <ranges>
+#include <algorithm>
+#include <memory>
 
 using Units = uint32_t;
 constexpr auto unitMap = std::array<Units, ResourceID::MAX_EXCLUSIVE>{1, 1, 2, 3}; // Map Resource ID to Units, stores inventory for each resource ID. ie: ResourceID 2 == Index 2 has at most 2 units
 
-struct PCB // Process
+template<typename T>
+class ListView : public std::span<T> // Read only list of a PCB, compares equal to any range of the same elements (ie: std::vector)
+{
+public:
+	using std::span<T>::span;
+
+	template<std::ranges::input_range R>
+	[[nodiscard]] bool operator==(const R& other) const
+	{
+		return std::ranges::equal(*this, other);
+	}
+};
+
+template<typename T, size_t Capacity>
+class SlotList // List stored inline with a fixed capacity, never allocates. Erasing keeps the order
+{
+public:
+	using value_type = T;
+
+	[[nodiscard]] T* begin() noexcept { return slots.data(); }
+	[[nodiscard]] T* end() noexcept { return slots.data() + count; }
+	[[nodiscard]] const T* begin() const noexcept { return slots.data(); }
+	[[nodiscard]] const T* end() const noexcept { return slots.data() + count; }
+	[[nodiscard]] size_t size() const noexcept { return count; }
+	[[nodiscard]] bool empty() const noexcept { return count == 0; }
+	[[nodiscard]] T& front() noexcept { assert(count != 0); return slots.front(); }
+	[[nodiscard]] const T& front() const noexcept { assert(count != 0); return slots.front(); }
+
+	void push_back(const T& item) noexcept
+	{
+		assert(count < Capacity);
+		slots[count++] = item;
+	}
+
+	void erase(const T* position) noexcept
+	{
+		assert(position >= begin() && position < end());
+		std::copy(position + 1, static_cast<const T*>(end()), begin() + (position - begin()));
+		count--;
+	}
+
+	void insert(const T* position, const T& item) noexcept // Shifts the items from position on
+	{
+		assert(count < Capacity && position >= begin() && position <= end());
+		const auto index = static_cast<size_t>(position - begin());
+		std::copy_backward(begin() + index, end(), end() + 1);
+		slots[index] = item;
+		count++;
+	}
+
+	void pop_front() noexcept { erase(begin()); }
+	void clear() noexcept { count = 0; }
+
+	template<std::ranges::input_range R> requires (!std::same_as<R, SlotList>)
+	[[nodiscard]] bool operator==(const R& other) const
+	{
+		return std::ranges::equal(*this, other);
+	}
+
+	[[nodiscard]] bool operator==(const SlotList& other) const
+	{
+		return std::ranges::equal(*this, other);
+	}
+
+private:
+	std::array<T, Capacity> slots{};
+	size_t count{0};
+};
+
+template<typename T, size_t N>
+class CowArray // Copies share their elements until one of them writes an element, which then clones that element only
+{
+public:
+	class Iterator // Read only
+	{
+	public:
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+
+		Iterator() = default;
+		explicit Iterator(const std::shared_ptr<T>* inElement) : element{inElement} {}
+
+		[[nodiscard]] const T& operator*() const { return **element; }
+		Iterator& operator++() { element++; return *this; }
+		Iterator operator++(int) { auto previous = *this; element++; return previous; }
+		[[nodiscard]] bool operator==(const Iterator& other) const = default;
+
+	private:
+		const std::shared_ptr<T>* element{nullptr};
+	};
+
+	CowArray()
+	{
+		for (auto& element : elements) element = std::make_shared<T>();
+	}
+
+	[[nodiscard]] T& operator[](size_t index) // References of the previous shared element are left on the copies
+	{
+		auto& element = elements[index];
+		if (element.use_count() > 1) element = std::make_shared<T>(*element);
+		return *element;
+	}
+
+	[[nodiscard]] const T& operator[](size_t index) const noexcept { return *elements[index]; }
+	[[nodiscard]] size_t getUnsharedBytes(const CowArray* base) const noexcept // Elements not shared with base, all of them without one. Heap memory an element owns aside
+	{
+		auto bytes = size_t{0};
+		for (size_t i = 0; i < N; i++) bytes += base != nullptr && base->elements[i] == elements[i] ? 0 : sizeof(T);
+		return bytes;
+	}
+	[[nodiscard]] Iterator begin() const noexcept { return Iterator{elements.data()}; }
+	[[nodiscard]] Iterator end() const noexcept { return Iterator{elements.data() + N}; }
+	[[nodiscard]] static constexpr size_t size() noexcept { return N; }
+
+private:
+	std::array<std::shared_ptr<T>, N> elements;
+};
+
+struct PCB // Process, a snapshot of one row of the ProcessTable. childs and resources point into the table
 {
 	enum class State : uint8_t {Free, Ready, Blocked};
 
@@ -21,14 +143,193 @@ struct PCB // Process
 	, id{0}
 	{}
 
-	~PCB(){} 
+	~PCB(){}
 
 	State state;
 	std::optional<ProcessID> parent;
-	std::vector<ProcessID> childs;
-	std::vector<std::pair<ResourceID, Units>> resources;
+	ListView<const ProcessID> childs;
+	ListView<const std::pair<ResourceID, Units>> resources;
 	PriorityID priority;
 	ProcessID id;
 };
 
+// Processes as a structure of arrays: the fields scanned by the scheduler are dense arrays indexed by ProcessID,
+// childs and resources live in fixed size slots of one arena (a process has at most MAX_EXCLUSIVE childs and one pair per resource)
+// Nothing allocates. A row is only valid when its generation matches the table's epoch, a stale row reads as a free process,
+// so reset() is a single epoch increment whatever the capacity is
+// Copies share the rows until one of them writes (copy on write), so a copy is a checkpoint that costs nothing until the next write
+class ProcessTable
+{
+public:
+	using ResourcePair = std::pair<ResourceID, Units>;
+
+	class Iterator // Yields PCB snapshots, so the table can be used as a range of PCBs
+	{
+	public:
+		using value_type = PCB;
+		using difference_type = std::ptrdiff_t;
+
+		Iterator() = default;
+		Iterator(const ProcessTable* inTable, uint32_t inIndex) : table{inTable}, index{inIndex} {}
+
+		[[nodiscard]] PCB operator*() const { return (*table)[index]; }
+		Iterator& operator++() { index++; return *this; }
+		Iterator operator++(int) { auto previous = *this; index++; return previous; }
+		[[nodiscard]] bool operator==(const Iterator& other) const = default;
+
+	private:
+		const ProcessTable* table{nullptr};
+		uint32_t index{0};
+	};
+
+	ProcessTable() = default;
+
+	void reset()
+	{
+		auto& table = edit();
+		if (++table.epoch == 0) // Wrapped around, the oldest generations would look current again
+		{
+			table.generations.fill(0);
+			table.epoch = 1;
+		}
+	}
+
+	[[nodiscard]] PCB operator[](ProcessID process) const
+	{
+		const auto& table = *rows;
+		auto pcb = PCB{};
+		pcb.id = process;
+		if (!isCurrent(process)) return pcb;
+		pcb.state = table.states[process];
+		pcb.parent = table.parents[process];
+		pcb.childs = {table.arena.childs[process].data(), table.childCounts[process]};
+		pcb.resources = {table.arena.resources[process].data(), table.resourceCounts[process]};
+		pcb.priority = table.priorities[process];
+		return pcb;
+	}
+
+	[[nodiscard]] Iterator begin() const noexcept { return {this, 0}; }
+	[[nodiscard]] Iterator end() const noexcept { return {this, ProcessID::MAX_EXCLUSIVE}; }
+	[[nodiscard]] static constexpr size_t size() noexcept { return ProcessID::MAX_EXCLUSIVE; }
+
+	[[nodiscard]] size_t getUnsharedBytes(const ProcessTable* base) const noexcept { return base != nullptr && base->rows == rows ? 0 : sizeof(Rows); } // All of it without a base
+
+	[[nodiscard]] std::optional<ProcessID> findFree() const noexcept
+	{
+		for (uint32_t process = 0; process < ProcessID::MAX_EXCLUSIVE; process++)
+		{
+			if (!isCurrent(process) || rows->states[process] == PCB::State::Free) return process;
+		}
+		return std::nullopt;
+	}
+
+	// Mutable accessors bring a stale row up to date first
+	[[nodiscard]] PCB::State& state(ProcessID process) { return touch(process).states[process]; }
+	[[nodiscard]] PriorityID& priority(ProcessID process) { return touch(process).priorities[process]; }
+	[[nodiscard]] PriorityID& effectivePriority(ProcessID process) { return touch(process).effectivePriorities[process]; } // Ready list level, raised above priority by inheritance or a ceiling
+	[[nodiscard]] std::optional<ProcessID>& parent(ProcessID process) { return touch(process).parents[process]; }
+
+	[[nodiscard]] std::span<ProcessID> childs(ProcessID process)
+	{
+		auto& table = touch(process);
+		return {table.arena.childs[process].data(), table.childCounts[process]};
+	}
+
+	[[nodiscard]] std::span<ResourcePair> resources(ProcessID process)
+	{
+		auto& table = touch(process);
+		return {table.arena.resources[process].data(), table.resourceCounts[process]};
+	}
 
+	// Const accessors only read, a stale row reads as a free process and the rows stay shared with the copies
+	[[nodiscard]] PCB::State state(ProcessID process) const noexcept { return isCurrent(process) ? rows->states[process] : PCB::State::Free; }
+	[[nodiscard]] PriorityID priority(ProcessID process) const noexcept { return isCurrent(process) ? rows->priorities[process] : PriorityID{0}; }
+	[[nodiscard]] PriorityID effectivePriority(ProcessID process) const noexcept { return isCurrent(process) ? rows->effectivePriorities[process] : PriorityID{0}; }
+	[[nodiscard]] std::span<const ProcessID> childs(ProcessID process) const noexcept
+	{
+		if (!isCurrent(process)) return {};
+		return {rows->arena.childs[process].data(), rows->childCounts[process]};
+	}
+	[[nodiscard]] std::span<const ResourcePair> resources(ProcessID process) const noexcept
+	{
+		if (!isCurrent(process)) return {};
+		return {rows->arena.resources[process].data(), rows->resourceCounts[process]};
+	}
+
+	void addChild(ProcessID process, ProcessID child)
+	{
+		auto& table = touch(process);
+		assert(table.childCounts[process] < ProcessID::MAX_EXCLUSIVE);
+		table.arena.childs[process][table.childCounts[process]++] = child;
+	}
+
+	void removeChild(ProcessID process, ProcessID child)
+	{
+		const auto childSpan = childs(process);
+		const auto iterChild = std::ranges::find(childSpan, child);
+		assert(iterChild != childSpan.end()); // Sanity check
+		std::ranges::copy(iterChild + 1, childSpan.end(), iterChild);
+		rows->childCounts[process]--;
+	}
+
+	void clearChilds(ProcessID process) { touch(process).childCounts[process] = 0; }
+
+	void addResource(ProcessID process, ResourceID resource, Units units)
+	{
+		auto& table = touch(process);
+		assert(table.resourceCounts[process] < ResourceID::MAX_EXCLUSIVE);
+		table.arena.resources[process][table.resourceCounts[process]++] = {resource, units};
+	}
+
+	void removeResource(ProcessID process, std::span<ResourcePair>::iterator iterPair) // iterPair comes from resources(), which already wrote the rows
+	{
+		std::ranges::copy(iterPair + 1, resources(process).end(), iterPair);
+		rows->resourceCounts[process]--;
+	}
+
+	void clearResources(ProcessID process) { touch(process).resourceCounts[process] = 0; }
+
+private:
+	struct Arena // Cold data, only touched by create/destroy and request/release
+	{
+		std::array<std::array<ProcessID, ProcessID::MAX_EXCLUSIVE>, ProcessID::MAX_EXCLUSIVE> childs;
+		std::array<std::array<ResourcePair, ResourceID::MAX_EXCLUSIVE>, ProcessID::MAX_EXCLUSIVE> resources;
+	};
+
+	struct Rows
+	{
+		uint32_t epoch{1};
+		std::array<uint32_t, ProcessID::MAX_EXCLUSIVE> generations{}; // Every row starts stale
+		std::array<PCB::State, ProcessID::MAX_EXCLUSIVE> states{};
+		std::array<PriorityID, ProcessID::MAX_EXCLUSIVE> priorities{};
+		std::array<PriorityID, ProcessID::MAX_EXCLUSIVE> effectivePriorities{};
+		std::array<std::optional<ProcessID>, ProcessID::MAX_EXCLUSIVE> parents{};
+		std::array<uint8_t, ProcessID::MAX_EXCLUSIVE> childCounts{};
+		std::array<uint8_t, ProcessID::MAX_EXCLUSIVE> resourceCounts{};
+		Arena arena{};
+	};
+
+	[[nodiscard]] bool isCurrent(ProcessID process) const noexcept { return rows->generations[process] == rows->epoch; }
+
+	[[nodiscard]] Rows& edit() // Unshare the rows before the first write after a copy
+	{
+		if (rows.use_count() > 1) rows = std::make_shared<Rows>(*rows);
+		return *rows;
+	}
+
+	Rows& touch(ProcessID process) // Stale slots of the arena are never read, the counts bound them
+	{
+		auto& table = edit();
+		if (isCurrent(process)) return table;
+		table.states[process] = PCB::State::Free;
+		table.priorities[process] = 0;
+		table.effectivePriorities[process] = 0;
+		table.parents[process] = std::nullopt;
+		table.childCounts[process] = 0;
+		table.resourceCounts[process] = 0;
+		table.generations[process] = table.epoch;
+		return table;
+	}
+
+	std::shared_ptr<Rows> rows{std::make_shared<Rows>()};
+};
@@ -1,8 +1,198 @@
 #pragma once
 
-#include <list>
 #include <cassert>
 #include <array>
+#include <bit>
+#include <optional>
+#include <vector>
+
+enum class WaitDiscipline : uint8_t
+{
+	Fifo // Serve in arrival order, the head blocks everybody behind it
+	, FirstFit // Serve the oldest waiter that fits
+	, Priority // Serve the highest priority waiter that fits, oldest first within a level
+	, SmallestFirst // Serve the smallest request that fits, a waiter bypassed by agingLimit grants is served next
+};
+
+// Blocked processes waiting for one resource. Waiters are bucketed by (priority, units), every bucket is a FIFO
+// so only the bucket heads are candidates whatever the discipline is
+class WaitQueue
+{
+public:
+	struct Waiter
+	{
+		ProcessID process;
+		Units units;
+		PriorityID priority;
+		uint64_t sequence; // Arrival order
+		uint64_t grantStamp; // grantCount when it arrived, for aging
+	};
+
+	static constexpr Units maxUnits = std::ranges::max(unitMap);
+	static constexpr uint64_t agingLimit = 4;
+
+	void push(ProcessID process, Units units, PriorityID priority)
+	{
+		assert(units != 0 && units <= maxUnits);
+		const auto bucket = getBucket(priority, units);
+		buckets[bucket].push_back({process, units, priority, nextSequence++, grantCount});
+		nonEmptyBuckets |= 1U << bucket;
+		count++;
+	}
+
+	[[nodiscard]] std::optional<Waiter> select(Units remain, WaitDiscipline discipline) const
+	{
+		auto best = std::optional<Waiter>{};
+		const auto isBetter = [discipline](const Waiter& waiter, const Waiter& other)
+		{
+			switch (discipline)
+			{
+				case WaitDiscipline::Priority: return std::pair{other.priority, waiter.sequence} < std::pair{waiter.priority, other.sequence};
+				case WaitDiscipline::SmallestFirst: return std::pair{waiter.units, waiter.sequence} < std::pair{other.units, other.sequence};
+				default: return waiter.sequence < other.sequence;
+			}
+		};
+		if (discipline == WaitDiscipline::Fifo || discipline == WaitDiscipline::SmallestFirst)
+		{
+			const auto oldest = getOldest();
+			if (!oldest.has_value()) return std::nullopt;
+			const auto isStarving = discipline == WaitDiscipline::SmallestFirst && grantCount - oldest->grantStamp >= agingLimit;
+			if (discipline == WaitDiscipline::Fifo || isStarving) return oldest->units <= remain ? oldest : std::nullopt; // Hold the units for the head
+		}
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1)
+		{
+			const auto& head = buckets[std::countr_zero(mask)].front();
+			if (head.units <= remain && (!best.has_value() || isBetter(head, best.value()))) best = head;
+		}
+		return best;
+	}
+
+	void pop(const Waiter& waiter) // Remove a waiter returned by select() and count the grant
+	{
+		const auto bucket = getBucket(waiter.priority, waiter.units);
+		assert(!buckets[bucket].empty() && buckets[bucket].front().sequence == waiter.sequence);
+		buckets[bucket].pop_front();
+		if (buckets[bucket].empty()) nonEmptyBuckets &= ~(1U << bucket);
+		count--;
+		grantCount++;
+	}
+
+	bool erase(ProcessID process) // A destroyed process leaves the queue
+	{
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1)
+		{
+			const auto bucket = std::countr_zero(mask);
+			const auto iterWaiter = std::ranges::find(buckets[bucket], process, &Waiter::process);
+			if (iterWaiter == buckets[bucket].end()) continue;
+			buckets[bucket].erase(iterWaiter);
+			if (buckets[bucket].empty()) nonEmptyBuckets &= ~(1U << bucket);
+			count--;
+			return true;
+		}
+		return false;
+	}
+
+	void setPriority(ProcessID process, PriorityID priority) // The waiter's effective priority changed, move it to its bucket at its arrival rank
+	{
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1)
+		{
+			const auto bucket = std::countr_zero(mask);
+			const auto iterWaiter = std::ranges::find(buckets[bucket], process, &Waiter::process);
+			if (iterWaiter == buckets[bucket].end()) continue;
+			auto waiter = *iterWaiter;
+			if (waiter.priority == priority) return;
+			buckets[bucket].erase(iterWaiter);
+			if (buckets[bucket].empty()) nonEmptyBuckets &= ~(1U << bucket);
+			waiter.priority = priority;
+			const auto target = getBucket(priority, waiter.units);
+			buckets[target].insert(std::ranges::upper_bound(buckets[target], waiter.sequence, {}, &Waiter::sequence), waiter);
+			nonEmptyBuckets |= 1U << target;
+			return;
+		}
+	}
+
+	[[nodiscard]] bool contains(ProcessID process) const
+	{
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1)
+		{
+			const auto& bucket = buckets[std::countr_zero(mask)];
+			if (std::ranges::find(bucket, process, &Waiter::process) != bucket.end()) return true;
+		}
+		return false;
+	}
+
+	void clear()
+	{
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1) buckets[std::countr_zero(mask)].clear();
+		nonEmptyBuckets = 0;
+		count = 0;
+	}
+
+	template<typename Function>
+	void forEachWaiter(Function function) const // Bucket order
+	{
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1)
+		{
+			for (const auto& waiter : buckets[std::countr_zero(mask)]) function(waiter.process);
+		}
+	}
+
+	void encode(std::vector<uint64_t>& state) const // Append what select() depends on: the waiters in arrival order and their age in grants
+	{
+		auto waiters = SlotList<Waiter, ProcessID::MAX_EXCLUSIVE>{};
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1)
+		{
+			for (const auto& waiter : buckets[std::countr_zero(mask)]) waiters.push_back(waiter);
+		}
+		std::ranges::sort(waiters, {}, &Waiter::sequence);
+		for (const auto& waiter : waiters) state.insert(state.end(), {uint64_t{waiter.process}, uint64_t{waiter.units}, uint64_t{waiter.priority}, grantCount - waiter.grantStamp});
+	}
+
+	[[nodiscard]] bool empty() const noexcept { return count == 0; }
+	[[nodiscard]] size_t size() const noexcept { return count; }
+
+	[[nodiscard]] SlotList<std::pair<ProcessID, Units>, ProcessID::MAX_EXCLUSIVE> getWaiters() const // {process, units} in arrival order
+	{
+		auto waiters = SlotList<Waiter, ProcessID::MAX_EXCLUSIVE>{};
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1)
+		{
+			for (const auto& waiter : buckets[std::countr_zero(mask)]) waiters.push_back(waiter);
+		}
+		std::ranges::sort(waiters, {}, &Waiter::sequence);
+		auto pairs = SlotList<std::pair<ProcessID, Units>, ProcessID::MAX_EXCLUSIVE>{};
+		for (const auto& waiter : waiters) pairs.push_back({waiter.process, waiter.units});
+		return pairs;
+	}
+
+	template<std::ranges::input_range R>
+	[[nodiscard]] bool operator==(const R& other) const
+	{
+		return getWaiters() == other;
+	}
+
+private:
+	static constexpr uint32_t bucketCount = PriorityID::MAX_EXCLUSIVE * maxUnits;
+	static_assert(bucketCount <= 32, "Buckets are tracked by a 32 bits mask");
+
+	[[nodiscard]] static uint32_t getBucket(PriorityID priority, Units units) noexcept { return priority * maxUnits + units - 1; }
+
+	[[nodiscard]] std::optional<Waiter> getOldest() const
+	{
+		auto oldest = std::optional<Waiter>{};
+		for (auto mask = nonEmptyBuckets; mask != 0; mask &= mask - 1)
+		{
+			const auto& head = buckets[std::countr_zero(mask)].front();
+			if (!oldest.has_value() || head.sequence < oldest->sequence) oldest = head;
+		}
+		return oldest;
+	}
+
+	std::array<SlotList<Waiter, ProcessID::MAX_EXCLUSIVE>, bucketCount> buckets{}; // A process waits on one resource at most
+	uint32_t nonEmptyBuckets{0};
+	size_t count{0};
+	uint64_t nextSequence{0};
+	uint64_t grantCount{0};
+};
 
 struct RCB // Resource
 {
@@ -20,5 +210,5 @@ struct RCB // Resource
 	State state;
 	ResourceID id;
 	Units remain;
-	std::list<std::pair<ProcessID, Units>> waitList; // Blocked processes waiting for this resource
+	WaitQueue waitList; // Blocked processes waiting for this resource
 };
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Trie of the command lines replayed in batch mode. The sequences of a trace repeat long prefixes (in, cr 2, cr 2, cr 1, to, ...),
+// so a node keeps the answer of its command and a checkpoint of the state after it, and a shared prefix only runs once:
+// walking the trie only answers, the system catches up by restoring the checkpoint of the last node once a command misses
+// A trie hangs from the state its first command ran on, so the same lines after another configuration (ie: wq, cpus) don't match
+class ReplayCache
+{
+public:
+	static constexpr size_t maxBytes = 32 << 20; // Past it commands run without being memorized, a node pins what its checkpoint doesn't share with its parent's
+
+	ReplayCache() :
+		nodes{}
+		, edges{}
+		, roots{}
+		, edgeKey{}
+		, state{}
+		, current{noNode}
+		, isBehind{false}
+		, hitCount{0}
+		, byteSize{0}
+	{}
+
+	void beginSequence(System& system) // The next command starts from the state of the system, ie: after a blank line or an in
+	{
+		sync(system);
+		system.encodeState(state);
+		const auto hash = System::hashState(state);
+		const auto [first, last] = roots.equal_range(hash);
+		const auto iterRoot = std::find_if(first, last, [this](const auto& root){ return root.second.state == state; }); // The hash only narrows the search
+		if (iterRoot != last) current = iterRoot->second.node;
+		else if (byteSize + sizeof(Node) + state.size() * sizeof(uint64_t) <= maxBytes)
+		{
+			current = static_cast<uint32_t>(nodes.size());
+			nodes.push_back({std::nullopt, -1});
+			roots.emplace(hash, Root{state, current});
+			byteSize += sizeof(Node) + state.size() * sizeof(uint64_t);
+		}
+		else current = noNode;
+	}
+
+	template<typename Run>
+	[[nodiscard]] int32_t replay(System& system, std::string_view command, Run run) // Run(System&) applies the command and returns its answer
+	{
+		if (current != noNode)
+		{
+			setEdgeKey(current, command);
+			const auto iterEdge = edges.find(edgeKey);
+			if (iterEdge != edges.end())
+			{
+				current = iterEdge->second;
+				isBehind = true;
+				hitCount++;
+				return nodes[current].answer;
+			}
+		}
+		sync(system);
+		const auto answer = run(system);
+		if (current == noNode) return answer;
+		auto checkpoint = system.checkpoint();
+		const auto& parent = nodes[current].checkpoint;
+		const auto bytes = sizeof(Node) + edgeKey.size() + System::getCheckpointBytes(checkpoint, parent.has_value() ? &parent.value() : nullptr);
+		if (byteSize + bytes > maxBytes)
+		{
+			current = noNode; // Off the trie until the next sequence
+			return answer;
+		}
+		edges.emplace(edgeKey, static_cast<uint32_t>(nodes.size())); // edgeKey was set by the miss
+		current = static_cast<uint32_t>(nodes.size());
+		nodes.push_back({std::move(checkpoint), answer});
+		byteSize += bytes;
+		return answer;
+	}
+
+	void sync(System& system) // Bring the system to the state after the commands walked so far
+	{
+		if (!isBehind) return;
+		system.restore(nodes[current].checkpoint.value());
+		isBehind = false;
+	}
+
+	[[nodiscard]] uint64_t getHitCount() const noexcept { return hitCount; } // Commands answered without running
+	[[nodiscard]] size_t getNodeCount() const noexcept { return nodes.size(); }
+	[[nodiscard]] size_t getByteSize() const noexcept { return byteSize; } // Counted against maxBytes, the containers' own overhead aside
+
+private:
+	struct Node
+	{
+		std::optional<System::Checkpoint> checkpoint; // None for a root, the system is never behind one
+		int32_t answer;
+	};
+
+	struct Root
+	{
+		std::vector<uint64_t> state; // System::encodeState() the trie starts from
+		uint32_t node;
+	};
+
+	static constexpr uint32_t noNode = UINT32_MAX;
+
+	void setEdgeKey(uint32_t parent, std::string_view command) // The parent node's index then the command, one map for every edge
+	{
+		edgeKey.resize(sizeof(parent));
+		std::memcpy(edgeKey.data(), &parent, sizeof(parent));
+		edgeKey += command;
+	}
+
+	std::vector<Node> nodes;
+	std::unordered_map<std::string, uint32_t> edges;
+	std::unordered_multimap<uint64_t, Root> roots; // State hash to the roots of the tries, compared on their whole state
+	std::string edgeKey; // Reused by every lookup
+	std::vector<uint64_t> state; // Reused by every beginSequence()
+	uint32_t current; // Node of the commands walked since the start of the sequence, noNode once off the trie
+	bool isBehind; // The system didn't run the commands walked since the last miss
+	uint64_t hitCount;
+	size_t byteSize;
+};
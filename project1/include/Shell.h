@@ -4,6 +4,12 @@
 #include <sstream>
 #include <cassert>
 #include <iostream>
+#include <charconv>
+#include <array>
+#include <optional>
+#include <algorithm>
+#include <vector>
+#include <unordered_set>
 
 //#ifdef _NDEBUG
 //	constexpr auto printExceptionMsg = true;
@@ -24,6 +30,10 @@ namespace
 			, {"rl", std::mem_fn(&System::release)}
 			, {"to", std::mem_fn(&System::timeout)}
 			, {"in", std::mem_fn(&System::init)}
+			, {"wq", std::mem_fn(&System::setWaitDiscipline)}
+			, {"pi", std::mem_fn(&System::setPriorityProtocol)}
+			, {"cpus", std::mem_fn(&System::setCpuCount)}
+			, {"cpu", std::mem_fn(&System::switchCpu)}
 			//, {"pp", std::mem_fn(&System::printProcesses)}
 			//, {"pr", std::mem_fn(&System::printResources)}
 			//, {"ppi", std::mem_fn(&System::printProcess)}
@@ -45,10 +55,11 @@ class Shell // Singleton
 				try
 				{
 					preRead();
-					auto command = readCommand();
-					auto tokens = parseCommand(command);
+					const auto command = readCommand();
+					if (!command.has_value()) return; // EOF
+					auto tokens = parseCommand(command.value());
 					runCommand(tokens, system);
-					std::cout << system.getRunningProcess() << '\n';
+					std::cout << getAnswer(system) << '\n';
 				}
 				catch (const std::runtime_error& error)
 				{
@@ -66,36 +77,99 @@ class Shell // Singleton
 			if (!inputFile) throw std::runtime_error{"Invalid input file."};
 
 			auto outputFile = std::ofstream{inputPath.parent_path()/"output.txt"}; // Create an output file, std::fstream{path, std::ios::out};
+			run(system, inputFile, outputFile);
+		}
 
-			auto command = std::string{};
+		// Batch mode (ie: a trace piped into stdin): no prompt, the input is read by large chunks and the running processes are written
+		// like in output.txt through a large buffer, space separated and a new line for every blank line of the input. Ends on EOF
+		// Shared prefixes of the sequences are answered from the ReplayCache while only System commands run without a hook and the events are dropped
+		void run(System& system, std::istream& input, std::ostream& output)
+		{
+			auto& previousSink = system.getOutputSink(); // Only the running processes are written, the events are dropped unless a sink was chosen
+			auto nullSink = NullSink{};
+			if (&previousSink == &system.getDefaultOutputSink()) system.setOutputSink(nullSink);
+
+			auto chunk = std::vector<char>(chunkSize);
+			auto partialLine = std::string{}; // A line cut by the end of a chunk, the others are split in place
+			auto outputBuffer = std::string{};
+			outputBuffer.reserve(chunkSize + 16);
+			auto tokens = std::vector<std::string>{}; // Reused by every line
+			auto commandKey = std::string{};
 			bool shouldPrintSpace = false;
-			while (std::getline(inputFile, command) || !inputFile.eof())
+			bool isMemoizing = &previousSink == &system.getDefaultOutputSink() && !commandHook && !system.hasProcessHooks(); // A replayed command emits nothing. Until a registered command runs, its effects are outside of System
+			bool isSequenceStart = true; // The trie is rooted by the first command of a sequence, or by the state an in leaves
+			const auto runLine = [&](std::string_view command)
 			{
-				if (command.size() == 1 && command.back() == '\r') command.pop_back(); // Linux only, command.empty() == true if the this line is empty. Windows doesn't have '\r'
+				if (command.size() == 1 && command.back() == '\r') command.remove_suffix(1); // Linux only, command.empty() == true if the this line is empty. Windows doesn't have '\r'
 				if (command.empty())
 				{
-					outputFile << '\n'; // Blank space seperating the input sequences
+					outputBuffer += '\n'; // Blank space seperating the input sequences
 					shouldPrintSpace = false; // Reset for the next sequence of commands
+					isSequenceStart = true;
 				}
 				else
 				{
-					auto outputContent = std::stringstream{};
 					if (!shouldPrintSpace) shouldPrintSpace = true; // Skip the first command in this sequence
-					else outputContent << " ";
-					try
+					else outputBuffer += ' ';
+					tokenize(command, tokens);
+					if (isMemoizing && !tokens.empty() && registeredCommands.contains(tokens.front()))
+					{
+						replayCache.sync(system);
+						isMemoizing = false;
+					}
+					auto answer = int32_t{-1};
+					if (isMemoizing && !tokens.empty() && tokens.front() == "in") // Resets whatever came before, so the sequences after it share one trie
 					{
-						auto tokens = parseCommand(command);
-						runCommand(tokens, system);
-						outputContent << system.getRunningProcess();
+						replayCache.sync(system);
+						answer = runForAnswer(tokens, system);
+						replayCache.beginSequence(system);
+						isSequenceStart = false;
 					}
-					catch (const std::runtime_error& error)
+					else if (isMemoizing)
+					{
+						if (isSequenceStart) replayCache.beginSequence(system);
+						isSequenceStart = false;
+						commandKey.clear();
+						for (const auto& token : tokens) commandKey.append(token).push_back(' ');
+						answer = replayCache.replay(system, commandKey, [&](System& target){ return runForAnswer(tokens, target); });
+					}
+					else answer = runForAnswer(tokens, system);
+					auto result = std::array<char, 12>{}; // Running process or -1, appended once the command is done so a failure never leaves half a line
+					outputBuffer.append(result.data(), std::to_chars(result.data(), result.data() + result.size(), answer).ptr);
+				}
+				if (outputBuffer.size() >= chunkSize)
+				{
+					output.write(outputBuffer.data(), static_cast<std::streamsize>(outputBuffer.size()));
+					outputBuffer.clear();
+				}
+			};
+
+			while (input)
+			{
+				input.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+				const auto chunkEnd = chunk.data() + input.gcount();
+				auto lineBegin = chunk.data();
+				for (auto newline = std::find(lineBegin, chunkEnd, '\n'); newline != chunkEnd; newline = std::find(lineBegin, chunkEnd, '\n'))
+				{
+					if (partialLine.empty()) runLine({lineBegin, newline});
+					else
 					{
-						outputContent << -1;
+						partialLine.append(lineBegin, newline);
+						runLine(partialLine);
+						partialLine.clear();
 					}
-					outputFile << outputContent.str();
+					lineBegin = newline + 1;
 				}
+				partialLine.append(lineBegin, chunkEnd);
 			}
-			outputFile << std::endl;
+			if (!partialLine.empty()) runLine(partialLine); // Last line without a new line
+			if (isMemoizing) replayCache.sync(system);
+
+			outputBuffer += '\n';
+			output.write(outputBuffer.data(), static_cast<std::streamsize>(outputBuffer.size()));
+			output.flush();
+			system.getOutputSink().flush();
+			system.setOutputSink(previousSink);
 		}
 
 		[[nodiscard]] static auto getInstance()
@@ -110,35 +184,66 @@ class Shell // Singleton
 
 		static bool isInstantiated;
 
+		[[nodiscard]] static Shell makeSession() // Independent instance next to the singleton, ie: one per client of a server
+		{
+			return Shell{};
+		}
+
+		void registerCommand(std::string name, CommandFunction function) // Add or replace a command, for simulators built on top of System
+		{
+			registeredCommands.insert(name);
+			commandMap.insert_or_assign(std::move(name), std::move(function));
+		}
+
+		void setCommandHook(std::function<void(System&)> hook) // Called after every command that succeeded
+		{
+			commandHook = std::move(hook);
+		}
+
+		[[nodiscard]] const ReplayCache& getReplayCache() const noexcept // For testing
+		{
+			return replayCache;
+		}
+
 	private:
-		Shell() : commandMap{getCommandMap()}{};
+		Shell() : commandMap{getCommandMap()}, registeredCommands{}, commandHook{}, replayCache{}{};
 
 		void preRead()
 		{
 			std::cout << "> ";
 		}
 
-		[[nodiscard]] std::string readCommand() const
+		[[nodiscard]] std::optional<std::string> readCommand() const
 		{
 			auto command = std::string{};
-			std::getline(std::cin, command);
+			if (!std::getline(std::cin, command)) return std::nullopt;
 			return command;
 		}
 
-		[[nodiscard]] std::vector<std::string> parseCommand(std::string command)
+		[[nodiscard]] std::vector<std::string> parseCommand(std::string_view command)
 		{
-			auto commandStream = std::istringstream{command};
 			auto tokens = std::vector<std::string>{};
-			auto token = std::string{};
-			while (commandStream >> token) // commandStream's delim is space, use getline() if \n is delim
+			tokenize(command, tokens);
+			return tokens; // tokens == {command, [argument1, argument2, ...]}
+		}
+
+		static void tokenize(std::string_view command, std::vector<std::string>& tokens) // Split on white spaces into tokens, reusing its strings
+		{
+			constexpr auto whiteSpaces = std::string_view{" \t\r\v\f"};
+			auto count = size_t{0};
+			for (auto begin = command.find_first_not_of(whiteSpaces); begin != std::string_view::npos; begin = command.find_first_not_of(whiteSpaces, begin))
 			{
-				tokens.push_back(token);
+				const auto end = std::min(command.find_first_of(whiteSpaces, begin), command.size());
+				if (count == tokens.size()) tokens.emplace_back();
+				tokens[count++].assign(command.substr(begin, end - begin));
+				begin = end;
 			}
-			return tokens; // tokens == {command, [argument1, argument2, ...]}
+			tokens.resize(count);
 		}
 
 		void runCommand(const std::vector<std::string>& tokens, System& system) const
 		{
+			if (tokens.empty()) throw std::runtime_error{"Invalid command."};
 			const auto iterPair = commandMap.find(tokens.front());
 			if (iterPair == commandMap.end()) throw std::runtime_error{"Invalid command."};
 			const auto& [command, function] = *iterPair;
@@ -146,9 +251,34 @@ class Shell // Singleton
 			std::advance(iterArg, 1); // argument1
 			const auto args = std::vector<std::string>(iterArg, tokens.end());
 			function(system, args);
+			if (commandHook) commandHook(system);
 		}
 
+		[[nodiscard]] int32_t runForAnswer(const std::vector<std::string>& tokens, System& system) const // Running process after the command, -1 if it failed or left the CPU idle
+		{
+			try
+			{
+				runCommand(tokens, system);
+				return getAnswer(system);
+			}
+			catch (const std::exception&) // std::invalid_argument of a malformed number too
+			{
+				return -1;
+			}
+		}
+
+		[[nodiscard]] static int32_t getAnswer(const System& system) // Running process on the current CPU, -1 if it's idle
+		{
+			const auto process = system.getRunningProcess(system.getCurrentCpu());
+			return process.has_value() ? static_cast<int32_t>(static_cast<uint32_t>(process.value())) : -1;
+		}
+
+		static constexpr size_t chunkSize = 1 << 16; // Bytes read from the input and written to the output at once in batch mode
+
 		std::unordered_map<std::string, CommandFunction> commandMap;
+		std::unordered_set<std::string> registeredCommands; // Replacing a System command too, their effects can't be replayed from a checkpoint
+		std::function<void(System&)> commandHook;
+		ReplayCache replayCache; // Kept across batches, ie: by a session of the server
 };
 bool Shell::isInstantiated = false;
 
@@ -10,6 +10,7 @@
 #include <ranges>
 #include <algorithm>
 #include <cmath>
+#include <utility>
 
 namespace
 {
@@ -43,22 +44,36 @@ namespace
 	}
 }
 
+enum class PriorityProtocol : uint8_t
+{
+	None
+	, Inheritance // A holder runs at the highest effective priority of the waiters of the resources it holds, transitively through blocked holders
+	, Ceiling // A holder runs at least at the ceiling of the resources it holds, the highest priority that requested them since init()
+};
+
 class System // Singleton
 {
 	public:
 		~System(){};
 
-		void create(const std::vector<std::string>& arguments)
+		static constexpr uint32_t maxCpus = ProcessID::MAX_EXCLUSIVE; // More would always idle
+
+		void create(const std::vector<std::string>& arguments) // cr <priority> [cpu], a CPU pins the process to it
 		{
-			checkArgumentSize(arguments, 1);
+			if (arguments.size() != 2) checkArgumentSize(arguments, 1);
 			const auto priorityID = toID<PriorityID>(arguments.front());
+			const auto pinnedCpu = arguments.size() == 2 ? std::optional{toCpu(arguments[1])} : std::nullopt;
 			const auto freeProcess = getFreeProcess();
-			const auto runningProcess = getRunningProcess();
-			processes[runningProcess].childs.push_back(freeProcess);
-			processes[freeProcess].parent = runningProcess;
-			processes[freeProcess].priority = priorityID;
+			const auto runningProcess = getRunningProcess(); // The parent, an idle CPU has none
+			if (createHook) createHook(freeProcess); // May throw, nothing is modified yet
+			processes.addChild(runningProcess, freeProcess);
+			processes.parent(freeProcess) = runningProcess;
+			processes.priority(freeProcess) = priorityID;
+			processes.effectivePriority(freeProcess) = priorityID;
+			affinity[freeProcess] = pinnedCpu;
+			cpuOf[freeProcess] = pinnedCpu.value_or(getLeastLoadedCpu());
 			readyProcess(freeProcess);
-			std::cout << "process " << freeProcess << " created\n";
+			emit({Event::Kind::Created, static_cast<uint8_t>(freeProcess)});
 			scheduler();
 		}
 
@@ -68,12 +83,12 @@ class System // Singleton
 			const auto process = toID<ProcessID>(arguments.front());
 			if (process == 0) throw std::runtime_error{"Can't destroy process 0."}; // There should never be an empty ready list-- process 0 cannot be deleted, blocked, etc.
 			const auto runningProcess = getRunningProcess();
-			const auto& runningProcessChilds = processes[runningProcess].childs;
+			const auto runningProcessChilds = std::as_const(processes).childs(runningProcess);
 			const auto isChild = std::ranges::find(runningProcessChilds, process) != runningProcessChilds.end();
 			if (process == runningProcess || isChild)
 			{
-				assert(processes[process].state != PCB::State::Free);
-				std::cout << destroyProcess(process) << " processes destroyed\n";
+				assert(std::as_const(processes).state(process) != PCB::State::Free);
+				emit({Event::Kind::Destroyed, static_cast<uint8_t>(destroyProcess(process))});
 				scheduler();
 			}
 			else throw std::runtime_error{"Specified process is not the running process or a child of such process."};
@@ -81,47 +96,82 @@ class System // Singleton
 
 		void request(const std::vector<std::string>& arguments)
 		{
+			if (arguments.size() > 2) return requestAll(arguments);
 			checkArgumentSize(arguments, 2);
 
 			const auto resource = toID<ResourceID>(arguments[0]);
-			auto& theResource = resources[resource];
 
 			const auto units = toUnits(resource, arguments[1]);
 			if (units == 0) throw std::runtime_error{"Attempted to request 0 units"};
 
 			const auto process = getRunningProcess();
 			if (process == 0) throw std::runtime_error{"Attempted to requesting resource for process 0 which can causes deadlock"};
-			auto& theProcess = processes[process];
+			if (getOwnedUnits(process, resource) == unitMap[resource]) throw std::runtime_error{"All ready own maximum number of units of this resource"};
+			raiseCeiling(resource, std::as_const(processes).priority(process));
 
+			auto& theResource = resources[resource];
 			if (theResource.state == RCB::State::Free) theResource.state = RCB::State::Allocated;
-			const auto toResourceID = [](const auto& pair)
-			{
-				const auto& [resourceID, units] = pair;
-				return resourceID;
-			};
-			const auto iterPair = std::ranges::find(theProcess.resources, resource, toResourceID);
-			if (iterPair != theProcess.resources.end() && iterPair->second == unitMap[resource]) throw std::runtime_error{"All ready own maximum number of units of this resource"};
-
 			if (theResource.remain >= units)
 			{
-				if (iterPair == theProcess.resources.end()) ownResource(theProcess, resource, units); // First time owning this resource
-				else // Accumulate the amount of units owns
-				{
-					iterPair->second += units;
-					resources[resource].remain -= units;
-				}
-				std::cout << units << " units of resource " << resource << " allocated\n";
+				grantResource(process, resource, units); // Own it the first time, accumulate the units owned after
+				emit({Event::Kind::Allocated, static_cast<uint8_t>(units), static_cast<uint8_t>(resource)});
+				updateEffectivePriority(process);
 			}
 			else
 			{
-				theProcess.state = PCB::State::Blocked;
-				removeFromReadyList(theProcess);
-				theResource.waitList.push_back({process, units});
-				std::cout << "process " << process << " blocked\n";
+				pendingRequests[process].clear();
+				pendingRequests[process].push_back({resource, units});
+				processes.state(process) = PCB::State::Blocked;
+				removeFromReadyList(process);
+				waitFor(process, resource, units);
+				emit({Event::Kind::Blocked, static_cast<uint8_t>(process)});
 				scheduler();
 			}
 		}
 
+		// rq <resource> <units> <resource> <units>...: all or nothing, the process either gets every part or blocks holding none of them
+		// A blocked process waits on a single resource, the first one short of units, so a release only looks at the waiters of the released resource
+		void requestAll(const std::vector<std::string>& arguments)
+		{
+			if (arguments.size() % 2 != 0 || arguments.size() > 2 * ResourceID::MAX_EXCLUSIVE) throw std::runtime_error{"Invalid number of arguments."};
+
+			auto parts = RequestParts{};
+			for (size_t i = 0; i < arguments.size(); i += 2)
+			{
+				const auto resource = toID<ResourceID>(arguments[i]);
+				const auto units = toUnits(resource, arguments[i + 1]);
+				if (units == 0) throw std::runtime_error{"Attempted to request 0 units"};
+				if (std::ranges::find(parts, resource, &RequestParts::value_type::first) != parts.end()) throw std::runtime_error{"Resource requested more than once"};
+				parts.push_back({resource, units});
+			}
+
+			const auto process = getRunningProcess();
+			if (process == 0) throw std::runtime_error{"Attempted to requesting resource for process 0 which can causes deadlock"};
+			for (const auto& [resource, units] : parts)
+			{
+				if (getOwnedUnits(process, resource) + units > unitMap[resource]) throw std::runtime_error{"Attempted to own more units than the inventory of a resource"};
+			}
+			for (const auto& [resource, units] : parts) raiseCeiling(resource, std::as_const(processes).priority(process));
+
+			const auto shortResource = findShortResource(parts);
+			if (!shortResource.has_value())
+			{
+				for (const auto& [resource, units] : parts)
+				{
+					grantResource(process, resource, units);
+					emit({Event::Kind::Allocated, static_cast<uint8_t>(units), static_cast<uint8_t>(resource)});
+				}
+				updateEffectivePriority(process);
+				return;
+			}
+			pendingRequests[process] = parts;
+			processes.state(process) = PCB::State::Blocked;
+			removeFromReadyList(process);
+			waitFor(process, shortResource->first, shortResource->second);
+			emit({Event::Kind::Blocked, static_cast<uint8_t>(process)});
+			scheduler();
+		}
+
 		void release(const std::vector<std::string>& arguments)
 		{
 			checkArgumentSize(arguments, 2);
@@ -133,9 +183,7 @@ class System // Singleton
 			if (units == 0) throw std::runtime_error{"Attempted to release 0 units"};
 
 			const auto process = getRunningProcess();
-			auto& theProcess = processes[process];
-
-			auto isFullyReleased = releaseResource(theProcess, resource, units);
+			auto isFullyReleased = releaseResource(process, resource, units);
 			assert(theResource.state == RCB::State::Allocated); // Sanity check
 
 			if (theResource.waitList.empty())
@@ -143,8 +191,9 @@ class System // Singleton
 				if (isFullyReleased) theResource.state = RCB::State::Free;
 			}
 			else tryUnblockProcesses(theResource);
+			updateEffectivePriority(process);
 
-			std::cout << units << " units of resource " << resource << " released\n";
+			emit({Event::Kind::Released, static_cast<uint8_t>(units), static_cast<uint8_t>(resource)});
 
 			scheduler();
 		}
@@ -153,32 +202,79 @@ class System // Singleton
 		{
 			checkArgumentSize(arguments, 0);
 			const auto& process = getRunningProcess();
-			const auto level = processes[process].priority;
-			readyList[level].erase(readyList[level].begin());
-			readyList[level].push_back(process);
+			const auto level = std::as_const(processes).effectivePriority(process);
+			auto& list = readyLists[currentCpu][level]; // Only rotates the current CPU
+			list.erase(list.begin());
+			list.push_back(process);
+			scheduler();
+		}
+
+		void setCpuCount(const std::vector<std::string>& arguments) // cpus <count>, also resets the system like init()
+		{
+			checkArgumentSize(arguments, 1);
+			const auto count = std::stof(arguments.front());
+			if (count < 1 || count > maxCpus || count - std::floor(count) != 0) throw std::runtime_error{"Invalid number of CPUs."};
+			for (uint32_t cpu = 0; cpu < cpuCount; cpu++) // CPUs left out of init() must not keep stale processes
+			{
+				for (auto& list : readyLists[cpu]) list.clear();
+			}
+			cpuCount = static_cast<uint32_t>(count);
+			init({});
+			emit({Event::Kind::CpuCount, static_cast<uint8_t>(cpuCount)});
+		}
+
+		void switchCpu(const std::vector<std::string>& arguments) // cpu <id>, the following commands act on that CPU
+		{
+			checkArgumentSize(arguments, 1);
+			currentCpu = toCpu(arguments.front());
+			scheduler();
+		}
+
+		void setWaitDiscipline(const std::vector<std::string>& arguments) // wq <fifo | firstfit | priority | smallest>
+		{
+			checkArgumentSize(arguments, 1);
+			const auto& name = arguments.front();
+			const auto iterName = std::ranges::find(waitDisciplineNames, name);
+			if (iterName == waitDisciplineNames.end()) throw std::runtime_error{"Unknown wait discipline."};
+			waitDiscipline = static_cast<WaitDiscipline>(iterName - waitDisciplineNames.begin());
+			emit({Event::Kind::WaitDiscipline, static_cast<uint8_t>(waitDiscipline)});
+		}
+
+		void setPriorityProtocol(const std::vector<std::string>& arguments) // pi <none | inheritance | ceiling>
+		{
+			checkArgumentSize(arguments, 1);
+			const auto& name = arguments.front();
+			const auto iterName = std::ranges::find(priorityProtocolNames, name);
+			if (iterName == priorityProtocolNames.end()) throw std::runtime_error{"Unknown priority protocol."};
+			priorityProtocol = static_cast<PriorityProtocol>(iterName - priorityProtocolNames.begin());
+			for (uint32_t process = 0; process < ProcessID::MAX_EXCLUSIVE; process++)
+			{
+				if (std::as_const(processes).state(process) != PCB::State::Free) updateEffectivePriority(process);
+			}
+			emit({Event::Kind::PriorityProtocol, static_cast<uint8_t>(priorityProtocol)});
 			scheduler();
 		}
 
 		void init(const std::vector<std::string>& arguments)
 		{
 			checkArgumentSize(arguments, 0);
-			const auto resetProcess = [](PCB& process)
-			{
-				process.parent = std::nullopt;
-				process.childs.clear();
-				process.resources.clear();
-				process.state = PCB::State::Free;
-				process.priority = 0;
-			};
-			std::ranges::for_each(processes, resetProcess);
+			processes.reset();
+			ceilings = {};
 			for (int i = 0; i < ResourceID::MAX_EXCLUSIVE; i++) // Can't do zip because g++ in UCI doesn't allow it
 			{
 				resources[i].waitList.clear();
 				resources[i].state = RCB::State::Free;
 				resources[i].remain = unitMap[i];
 			}
-			for (auto& list : readyList) {list.clear();}
-			readyProcess(processes.front().id);
+			for (uint32_t cpu = 0; cpu < cpuCount; cpu++)
+			{
+				for (auto& list : readyLists[cpu]) {list.clear();}
+			}
+			currentCpu = 0;
+			migrationCount = 0;
+			cpuOf[0] = 0;
+			affinity[0] = 0;
+			readyProcess(0);
 		}
 
 		[[nodiscard]] static auto getInstance()
@@ -193,10 +289,162 @@ class System // Singleton
 
 		static bool isInstantiated;
 
-		// For testing and convience
-		const auto& getReadyList() const noexcept
+		[[nodiscard]] static System makeSession() // Independent instance next to the singleton, ie: one per client of a server
+		{
+			return System{};
+		}
+
+		// Let another component own state per process (ie: an address space). The destroy hook also has to release a process blocked through blockRunningProcess()
+		void setProcessHooks(std::function<void(ProcessID)> onCreate, std::function<void(ProcessID)> onDestroy)
+		{
+			createHook = std::move(onCreate);
+			destroyHook = std::move(onDestroy);
+		}
+
+		ProcessID blockRunningProcess() // Block on a queue owned outside of System (ie: disk I/O), unblockProcess() readies the process again
+		{
+			const auto process = getRunningProcess();
+			if (process == 0) throw std::runtime_error{"Process 0 can't be blocked."};
+			processes.state(process) = PCB::State::Blocked;
+			removeFromReadyList(process);
+			blockedOn[process] = std::nullopt;
+			emit({Event::Kind::Blocked, static_cast<uint8_t>(process)});
+			scheduler();
+			return process;
+		}
+
+		void unblockProcess(ProcessID process)
+		{
+			if (std::as_const(processes).state(process) != PCB::State::Blocked) throw std::runtime_error{"Process isn't blocked."};
+			readyProcess(process);
+			scheduler();
+		}
+
+		struct Checkpoint; // Whole simulated state, the hooks and the sink aside
+
+		[[nodiscard]] Checkpoint checkpoint() const // O(1), the processes, resources and readyLists are shared with the System until either side writes them
+		{
+			return Checkpoint{processes, resources, readyLists, pendingRequests, waitDiscipline, priorityProtocol, ceilings, blockedOn, cpuCount, currentCpu, cpuOf, affinity, migrationCount};
+		}
+
+		void restore(const Checkpoint& checkpoint) // The checkpoint stays valid, fork as many continuations from it as needed
+		{
+			processes = checkpoint.processes;
+			resources = checkpoint.resources;
+			readyLists = checkpoint.readyLists;
+			pendingRequests = checkpoint.pendingRequests;
+			waitDiscipline = checkpoint.waitDiscipline;
+			priorityProtocol = checkpoint.priorityProtocol;
+			ceilings = checkpoint.ceilings;
+			blockedOn = checkpoint.blockedOn;
+			cpuCount = checkpoint.cpuCount;
+			currentCpu = checkpoint.currentCpu;
+			cpuOf = checkpoint.cpuOf;
+			affinity = checkpoint.affinity;
+			migrationCount = checkpoint.migrationCount;
+		}
+
+		void encodeState(std::vector<uint64_t>& state) const // The simulated state as values, equal for states that answer every command the same way
+		{
+			state.clear();
+			const auto mix = [&state](uint64_t value){ state.push_back(value); };
+			for (const auto& pcb : processes)
+			{
+				mix(static_cast<uint64_t>(pcb.state));
+				if (pcb.state == PCB::State::Free) continue; // The rest of a free row is never read
+				mix(pcb.parent.has_value() ? pcb.parent.value() + 1 : 0);
+				mix(pcb.priority);
+				mix(processes.effectivePriority(pcb.id));
+				mix(pcb.childs.size());
+				for (const auto child : pcb.childs) mix(child);
+				mix(pcb.resources.size());
+				for (const auto& [resource, units] : pcb.resources) mix(resource * 256 + units);
+				mix(cpuOf[pcb.id]);
+				mix(affinity[pcb.id].has_value() ? affinity[pcb.id].value() + 1 : 0);
+				if (pcb.state != PCB::State::Blocked) continue;
+				mix(blockedOn[pcb.id].has_value() ? blockedOn[pcb.id].value() + 1 : 0);
+				mix(pendingRequests[pcb.id].size());
+				for (const auto& [resource, units] : pendingRequests[pcb.id]) mix(resource * 256 + units);
+			}
+			for (const auto& resource : resources)
+			{
+				mix(static_cast<uint64_t>(resource.state));
+				mix(resource.remain);
+				resource.waitList.encode(state);
+			}
+			for (uint32_t cpu = 0; cpu < cpuCount; cpu++)
+			{
+				for (const auto& list : readyLists[cpu])
+				{
+					mix(list.size());
+					for (const auto process : list) mix(process);
+				}
+			}
+			for (const auto ceiling : ceilings) mix(ceiling);
+			for (const auto value : {uint64_t{static_cast<uint8_t>(waitDiscipline)}, uint64_t{static_cast<uint8_t>(priorityProtocol)}, uint64_t{cpuCount}, uint64_t{currentCpu}, migrationCount}) mix(value);
+		}
+
+		[[nodiscard]] uint64_t hashState() const
+		{
+			auto state = std::vector<uint64_t>{};
+			encodeState(state);
+			return hashState(state);
+		}
+
+		[[nodiscard]] static uint64_t hashState(const std::vector<uint64_t>& state) noexcept // FNV-1a over encodeState()
+		{
+			auto hash = uint64_t{14695981039346656037ull};
+			for (const auto value : state) hash = (hash ^ value) * 1099511628211ull;
+			return hash;
+		}
+
+		[[nodiscard]] static size_t getCheckpointBytes(const Checkpoint& checkpoint, const Checkpoint* base) noexcept // Memory the checkpoint pins that base doesn't share
+		{
+			const auto bytes = checkpoint.processes.getUnsharedBytes(base != nullptr ? &base->processes : nullptr)
+				+ checkpoint.resources.getUnsharedBytes(base != nullptr ? &base->resources : nullptr)
+				+ checkpoint.readyLists.getUnsharedBytes(base != nullptr ? &base->readyLists : nullptr);
+			return sizeof(Checkpoint) + bytes;
+		}
+
+		[[nodiscard]] bool hasProcessHooks() const noexcept
+		{
+			return createHook || destroyHook;
+		}
+
+		// For testing and convience. A checkpoint makes the next write of a readyList or resource move it, references taken before see the old one
+		const auto& getReadyList(uint32_t cpu = 0) const noexcept
+		{
+			return readyLists[cpu];
+		}
+
+		[[nodiscard]] uint64_t getMigrationCount() const noexcept
+		{
+			return migrationCount;
+		}
+
+		[[nodiscard]] uint32_t getCurrentCpu() const noexcept
+		{
+			return currentCpu;
+		}
+
+		[[nodiscard]] uint32_t getCpuCount() const noexcept
+		{
+			return cpuCount;
+		}
+
+		void setOutputSink(OutputSink& inSink) noexcept // The sink must outlive its use, getDefaultOutputSink() is the one on std::cout
+		{
+			sink = &inSink;
+		}
+
+		[[nodiscard]] static OutputSink& getDefaultOutputSink() noexcept // Text on std::cout
+		{
+			return coutSink;
+		}
+
+		[[nodiscard]] OutputSink& getOutputSink() const noexcept
 		{
-			return readyList;
+			return *sink;
 		}
 
 		const auto& getProcesses() const noexcept
@@ -209,61 +457,171 @@ class System // Singleton
 			return resources;
 		}
 
-		[[nodiscard]] inline ProcessID getRunningProcess()
+		[[nodiscard]] inline ProcessID getRunningProcess() // On the current CPU
+		{
+			const auto process = getRunningProcess(currentCpu);
+			if (!process.has_value()) throw std::runtime_error{"None of the process is ready."};
+			return process.value();
+		}
+
+		[[nodiscard]] std::optional<ProcessID> getRunningProcess(uint32_t cpu) const
 		{
 			for (int level = PriorityID::MAX_EXCLUSIVE - 1; level >= 0; level--)
 			{
 				// Return the process at the highest priority level
-				if (!readyList[level].empty()) return readyList[level].front();
+				if (!readyLists[cpu][level].empty()) return readyLists[cpu][level].front();
 			}
-			throw std::runtime_error{"None of the process is ready."};
+			return std::nullopt; // Idle
 		}
 
 	private:
+		using RequestParts = SlotList<std::pair<ResourceID, Units>, ResourceID::MAX_EXCLUSIVE>;
+		using ReadyList = std::array<std::list<ProcessID>, PriorityID::MAX_EXCLUSIVE>;
+
+	public:
+		struct Checkpoint
+		{
+			ProcessTable processes;
+			CowArray<RCB, ResourceID::MAX_EXCLUSIVE> resources;
+			CowArray<ReadyList, maxCpus> readyLists;
+			std::array<RequestParts, ProcessID::MAX_EXCLUSIVE> pendingRequests; // The rest is small and copied
+			WaitDiscipline waitDiscipline;
+			PriorityProtocol priorityProtocol;
+			std::array<PriorityID, ResourceID::MAX_EXCLUSIVE> ceilings;
+			std::array<std::optional<ResourceID>, ProcessID::MAX_EXCLUSIVE> blockedOn;
+			uint32_t cpuCount;
+			uint32_t currentCpu;
+			std::array<uint32_t, ProcessID::MAX_EXCLUSIVE> cpuOf;
+			std::array<std::optional<uint32_t>, ProcessID::MAX_EXCLUSIVE> affinity;
+			uint64_t migrationCount;
+		};
+
+	private:
+
 		System()
 		: processes{}
 		, resources{}
-		, readyList{}
+		, readyLists{}
+		, pendingRequests{}
+		, createHook{}
+		, destroyHook{}
+		, waitDiscipline{WaitDiscipline::Fifo}
+		, priorityProtocol{PriorityProtocol::None}
+		, ceilings{}
+		, blockedOn{}
+		, cpuCount{1}
+		, currentCpu{0}
+		, cpuOf{}
+		, affinity{}
+		, migrationCount{0}
+		, sink{&coutSink}
 		{
-			auto id = uint32_t{0};
-			for (PCB& process : processes) process.id = id++;
-			id = 0;
-			for (RCB& resource : resources)
+			for (uint32_t id = 0; id < ResourceID::MAX_EXCLUSIVE; id++)
 			{
-				resource.id = id++;
-				resource.remain = unitMap[resource.id];
+				resources[id].id = id;
+				resources[id].remain = unitMap[id];
 			}
-			readyProcess(processes.front().id);
+			affinity[0] = 0;
+			readyProcess(0);
 		};
 
+		void emit(const Event& event)
+		{
+			sink->write(event);
+		}
+
+		static inline auto coutSink = StreamSink{std::cout};
+
 		void inline scheduler()
 		{
-			const auto process = getRunningProcess();
-			std::cout << "process " << process << " running\n";
+			balance();
+			const auto process = getRunningProcess(currentCpu);
+			if (process.has_value()) emit({Event::Kind::Running, static_cast<uint8_t>(process.value())}); // Nothing runs on an idle CPU, the command still succeeded
+		}
+
+		[[nodiscard]] uint32_t toCpu(std::string_view string) const
+		{
+			const auto maybeCpu = std::stof(string.data());
+			if (maybeCpu < 0 || maybeCpu >= cpuCount) throw std::runtime_error{"Invalid CPU."};
+			if (maybeCpu - std::floor(maybeCpu) != 0) throw std::runtime_error{"Fractions are not allowed."};
+			return static_cast<uint32_t>(maybeCpu);
+		}
+
+		[[nodiscard]] size_t getLoad(uint32_t cpu) const // Ready processes, the running one included
+		{
+			auto load = size_t{0};
+			for (const auto& list : readyLists[cpu]) load += list.size();
+			return load;
+		}
+
+		[[nodiscard]] uint32_t getLeastLoadedCpu() const
+		{
+			auto leastLoaded = uint32_t{0};
+			for (uint32_t cpu = 1; cpu < cpuCount; cpu++)
+			{
+				if (getLoad(cpu) < getLoad(leastLoaded)) leastLoaded = cpu;
+			}
+			return leastLoaded;
+		}
+
+		[[nodiscard]] std::optional<ProcessID> findStealable(uint32_t cpu) const // The lowest priority, latest waiting process that isn't pinned
+		{
+			const auto running = getRunningProcess(cpu);
+			for (const auto& list : readyLists[cpu])
+			{
+				const auto iterProcess = std::ranges::find_if(list.rbegin(), list.rend(), [&](ProcessID process){ return process != running && !affinity[process].has_value(); });
+				if (iterProcess != list.rend()) return *iterProcess;
+			}
+			return std::nullopt;
+		}
+
+		void balance() // Work stealing: an idle CPU takes a waiting process from the most loaded CPU that has one to give
+		{
+			for (uint32_t thief = 0; thief < cpuCount; thief++)
+			{
+				if (getLoad(thief) != 0) continue;
+				auto victim = std::optional<std::pair<size_t, ProcessID>>{}; // {load, process}
+				for (uint32_t cpu = 0; cpu < cpuCount; cpu++)
+				{
+					const auto load = getLoad(cpu);
+					if (load < 2 || (victim.has_value() && victim->first >= load)) continue;
+					const auto stealable = findStealable(cpu);
+					if (stealable.has_value()) victim = {load, stealable.value()};
+				}
+				if (!victim.has_value()) continue;
+				const auto process = victim->second;
+				const auto from = cpuOf[process];
+				removeFromReadyList(process);
+				cpuOf[process] = thief;
+				readyLists[thief][std::as_const(processes).effectivePriority(process)].push_back(process);
+				migrationCount++;
+				emit({Event::Kind::Migrated, static_cast<uint8_t>(process), static_cast<uint8_t>(from), static_cast<uint8_t>(thief)});
+			}
 		}
 		 
 		[[nodiscard]] inline ProcessID getFreeProcess()
 		{
-			const auto iterProcess = std::ranges::find(processes, PCB::State::Free, &PCB::state);
-			if (iterProcess == processes.end()) throw std::runtime_error{"All of the processes are in used."};
-			else return iterProcess->id;
+			const auto freeProcess = processes.findFree();
+			if (!freeProcess.has_value()) throw std::runtime_error{"All of the processes are in used."};
+			else return freeProcess.value();
 		}
 
 		inline void readyProcess(ProcessID process)
 		{
-			assert(processes[process].state != PCB::State::Ready);
-			processes[process].state = PCB::State::Ready;
-			readyList[processes[process].priority].push_back(process);
+			assert(std::as_const(processes).state(process) != PCB::State::Ready);
+			processes.state(process) = PCB::State::Ready;
+			readyLists[cpuOf[process]][std::as_const(processes).effectivePriority(process)].push_back(process); // Back to the CPU it last ran on
 		}
 
-		inline void removeFromReadyList(PCB& process)
+		inline void removeFromReadyList(ProcessID process)
 		{
-			const auto iterProcess = std::ranges::find(readyList[process.priority], process.id);
-			assert(iterProcess != readyList[process.priority].end());
-			readyList[process.priority].erase(iterProcess);
+			auto& list = readyLists[cpuOf[process]][std::as_const(processes).effectivePriority(process)];
+			const auto iterProcess = std::ranges::find(list, process);
+			assert(iterProcess != list.end());
+			list.erase(iterProcess);
 		}
 
-		[[nodiscard]] bool releaseResource(PCB& process, ResourceID resource, Units units)
+		[[nodiscard]] bool releaseResource(ProcessID process, ResourceID resource, Units units)
 		{
 			bool isFullyReleased = false;
 			const auto toResourceID = [](const auto& pair)
@@ -271,14 +629,15 @@ class System // Singleton
 				const auto& [resourceID, units] = pair;
 				return resourceID;
 			};
-			const auto iterPair = std::ranges::find(process.resources, resource, toResourceID);
-			if (iterPair == process.resources.end()) throw std::runtime_error{"The current running process doesn't hold that resource"};
+			const auto processResources = processes.resources(process);
+			const auto iterPair = std::ranges::find(processResources, resource, toResourceID);
+			if (iterPair == processResources.end()) throw std::runtime_error{"The current running process doesn't hold that resource"};
 			auto& [resourceID, ownUnits] = *iterPair;
 			if (ownUnits < units) throw std::runtime_error{"Attempting to release more resource than the number of owned resource"};
 			else if (ownUnits == units)
 			{
 				isFullyReleased = true;
-				process.resources.erase(iterPair);
+				processes.removeResource(process, iterPair);
 			}
 			else ownUnits -= units; // Don't remove yet because we still hold the resource
 			// Refund the units to the resource
@@ -286,94 +645,187 @@ class System // Singleton
 			return isFullyReleased;
 		}
 
-		inline void ownResource(PCB& process, ResourceID resource, Units units)
+		inline void ownResource(ProcessID process, ResourceID resource, Units units)
 		{
-			process.resources.push_back({resource, units});
+			processes.addResource(process, resource, units);
 			resources[resource].remain -= units;
 		}
+		inline void grantResource(ProcessID process, ResourceID resource, Units units) // Own or accumulate
+		{
+			resources[resource].state = RCB::State::Allocated;
+			const auto processResources = processes.resources(process);
+			const auto iterPair = std::ranges::find(processResources, resource, &ProcessTable::ResourcePair::first);
+			if (iterPair == processResources.end()) ownResource(process, resource, units);
+			else
+			{
+				iterPair->second += units;
+				resources[resource].remain -= units;
+			}
+		}
+		[[nodiscard]] Units getOwnedUnits(ProcessID process, ResourceID resource) const
+		{
+			const auto processResources = processes.resources(process);
+			const auto iterPair = std::ranges::find(processResources, resource, &ProcessTable::ResourcePair::first);
+			return iterPair == processResources.end() ? 0 : iterPair->second;
+		}
+		[[nodiscard]] std::optional<std::pair<ResourceID, Units>> findShortResource(const RequestParts& parts) const
+		{
+			const auto iterPart = std::ranges::find_if(parts, [this](const auto& part){ return std::as_const(resources)[part.first].remain < part.second; });
+			if (iterPart == parts.end()) return std::nullopt;
+			return *iterPart;
+		}
 		inline void tryUnblockProcesses(RCB& resource) // Can potentially unblock processes but depend on the number of units freed
 		{
-			do
+			while (!resource.waitList.empty() && resource.remain != 0)
 			{
-				const auto [blockedProcess, units] = resource.waitList.front(); // Make a copy because we will pop it
-				if (resource.remain >= units)
+				const auto waiter = resource.waitList.select(resource.remain, waitDiscipline);
+				if (!waiter.has_value()) break;
+				resource.waitList.pop(waiter.value());
+				const auto blockedProcess = waiter->process;
+				const auto shortResource = findShortResource(pendingRequests[blockedProcess]);
+				if (shortResource.has_value()) // Part of an all or nothing request, wait on the next resource short of units
 				{
-					resource.waitList.pop_front();
-					readyProcess(blockedProcess);
-					ownResource(processes[blockedProcess], resource.id, units);
+					waitFor(blockedProcess, shortResource->first, shortResource->second);
+					continue;
 				}
-				else return;
-			} while (resource.remain != 0);
+				blockedOn[blockedProcess] = std::nullopt;
+				readyProcess(blockedProcess);
+				for (const auto& [pendingResource, pendingUnits] : pendingRequests[blockedProcess]) grantResource(blockedProcess, pendingResource, pendingUnits); // Accumulate into a pair already held
+				pendingRequests[blockedProcess].clear();
+				updateEffectivePriority(blockedProcess);
+			}
 			// Unblocked processes are transferred to ready state and own this resources # units
+			if (resource.waitList.empty() && resource.remain == unitMap[resource.id]) resource.state = RCB::State::Free; // Every waiter moved to another resource
+			updateHolders(resource.id); // Waiters left
+		}
+		inline void waitFor(ProcessID process, ResourceID resource, Units units)
+		{
+			resources[resource].waitList.push(process, units, std::as_const(processes).effectivePriority(process));
+			blockedOn[process] = resource;
+			updateHolders(resource);
+		}
+
+		inline void raiseCeiling(ResourceID resource, PriorityID priority)
+		{
+			if (ceilings[resource] >= priority) return;
+			ceilings[resource] = priority;
+			updateHolders(resource);
+		}
+		[[nodiscard]] PriorityID getInheritedPriority(ProcessID process) const
+		{
+			auto level = uint32_t{processes.priority(process)};
+			if (priorityProtocol == PriorityProtocol::None) return level;
+			for (const auto& [resource, units] : processes.resources(process))
+			{
+				if (priorityProtocol == PriorityProtocol::Ceiling) level = std::max<uint32_t>(level, ceilings[resource]);
+				else resources[resource].waitList.forEachWaiter([this, &level](ProcessID waiter){ level = std::max<uint32_t>(level, processes.effectivePriority(waiter)); });
+			}
+			return level;
+		}
+		void updateEffectivePriority(ProcessID process) // Move a ready process to its new level, or pass the change on to the holders of the resource it waits for
+		{
+			const auto level = getInheritedPriority(process);
+			if (std::as_const(processes).effectivePriority(process) == level) return;
+			const auto isReady = std::as_const(processes).state(process) == PCB::State::Ready;
+			if (isReady) removeFromReadyList(process);
+			processes.effectivePriority(process) = level;
+			if (isReady) readyLists[cpuOf[process]][level].push_back(process);
+			else if (blockedOn[process].has_value())
+			{
+				resources[blockedOn[process].value()].waitList.setPriority(process, level); // Priority waitLists order by the current level
+				updateHolders(blockedOn[process].value());
+			}
+		}
+		void updateHolders(ResourceID resource)
+		{
+			if (priorityProtocol == PriorityProtocol::None) return;
+			for (uint32_t process = 0; process < ProcessID::MAX_EXCLUSIVE; process++)
+			{
+				if (getOwnedUnits(process, resource) != 0) updateEffectivePriority(process);
+			}
 		}
 
-		inline void removeParent(PCB& process, PCB& parent)
+		inline void removeParent(ProcessID process, ProcessID parent)
 		{
-			auto& parentChilds = parent.childs;
-			const auto iterChild = std::ranges::find(parentChilds, process.id);
-			assert(iterChild != parentChilds.end()); // Sanity check
-			parentChilds.erase(iterChild);
-			process.parent = std::nullopt; // Remove parent
+			processes.removeChild(parent, process);
+			processes.parent(process) = std::nullopt; // Remove parent
 		}
-		[[nodiscard]] inline uint32_t removeChilds(PCB& process)
+		[[nodiscard]] inline uint32_t removeChilds(ProcessID process)
 		{
-			auto childs = process.childs; // Make a copy. When destroy a child and disconnect it from this parent process via removeParent, the ranged loop will become UB
+			const auto processChilds = std::as_const(processes).childs(process);
+			auto childs = std::array<ProcessID, ProcessID::MAX_EXCLUSIVE>{}; // Make a copy. When destroy a child and disconnect it from this parent process via removeParent, the ranged loop will become UB
+			const auto childCount = processChilds.size();
+			std::ranges::copy(processChilds, childs.begin());
 			auto processDestroyed = uint32_t{0};
-			for (ProcessID child : childs)
+			for (ProcessID child : std::span{childs.data(), childCount})
 			{
 				processDestroyed += destroyProcess(child);
 			}
-			process.childs.clear();
+			processes.clearChilds(process);
 			return processDestroyed;
 		}
-		inline void releaseResources(PCB& process)
+		inline void releaseResources(ProcessID process)
 		{
-			for (const auto& [resource, units] : process.resources)
+			while (!std::as_const(processes).resources(process).empty()) // releaseResource() removes the pair, so always take the front one
 			{
+				const auto [resource, units] = std::as_const(processes).resources(process).front();
 				auto& theResource = resources[resource];
 				auto isFullyReleased = releaseResource(process, resource, units); // Always perform a full release so we don't need to use the return value
 				assert(isFullyReleased); // Sanity check
 				if (theResource.waitList.empty()) theResource.state = RCB::State::Free;
 				else tryUnblockProcesses(theResource);
 			}
-			process.resources.clear();
+			processes.clearResources(process);
 		}
-		inline void removeFromList(PCB& process) // Either remove from the readyList or the waitList
+		inline void removeFromList(ProcessID process) // Either remove from the readyList or the waitList
 		{
-			const auto iterProcess = std::ranges::find(readyList[process.priority], process.id);
-			if (iterProcess != readyList[process.priority].end())
+			auto& list = readyLists[cpuOf[process]][std::as_const(processes).effectivePriority(process)];
+			const auto iterProcess = std::ranges::find(list, process);
+			if (iterProcess != list.end())
 			{
-				readyList[process.priority].erase(iterProcess);
+				list.erase(iterProcess);
 				return;
 			}
-			for (auto& resource : resources)
+			for (uint32_t resource = 0; resource < ResourceID::MAX_EXCLUSIVE; resource++)
 			{
-				const auto toID = [](const auto& pair){ return pair.first; };
-				const auto iterPair = std::ranges::find(resource.waitList, process.id, toID);
-				if (iterPair != resource.waitList.end())
-				{
-					resource.waitList.erase(iterPair);
-					return;
-				}
+				if (!std::as_const(resources)[resource].waitList.contains(process)) continue; // Only the resource written is unshared
+				resources[resource].waitList.erase(process);
+				updateHolders(resource);
+				return;
 			}
-			assert(false); // Can't reach here because this mean the process isn't in the RL or the WL
+			assert(std::as_const(processes).state(process) == PCB::State::Blocked); // Blocked outside of System, the destroy hook took it off that queue
 		}
 		[[nodiscard]] uint32_t destroyProcess(ProcessID process) // Return the number of processes destroyed
 		{
-			auto& theProcess = processes[process];
 			auto processDestroyed = uint32_t{1}; // This process
-			if (theProcess.parent.has_value()) removeParent(theProcess, processes[theProcess.parent.value()]); // In case this is the process 0
-			processDestroyed += removeChilds(theProcess);
-			releaseResources(theProcess);
-			removeFromList(theProcess);
-			theProcess.state = PCB::State::Free;
-			theProcess.priority = 0;
+			const auto parent = processes.parent(process);
+			if (parent.has_value()) removeParent(process, parent.value()); // In case this is the process 0
+			processDestroyed += removeChilds(process);
+			releaseResources(process);
+			if (destroyHook) destroyHook(process);
+			removeFromList(process);
+			processes.state(process) = PCB::State::Free;
+			processes.priority(process) = 0;
+			processes.effectivePriority(process) = 0;
 			return processDestroyed;
 		}
 
-		std::array<PCB, ProcessID::MAX_EXCLUSIVE> processes;
-		std::array<RCB, ResourceID::MAX_EXCLUSIVE> resources;
-		std::array<std::list<ProcessID>, PriorityID::MAX_EXCLUSIVE> readyList; // Current running process is at the head of the readyList
+		ProcessTable processes;
+		CowArray<RCB, ResourceID::MAX_EXCLUSIVE> resources;
+		CowArray<ReadyList, maxCpus> readyLists; // Per CPU, its running process is at the head of its readyList
+		std::array<RequestParts, ProcessID::MAX_EXCLUSIVE> pendingRequests; // Every part of the request a blocked process waits for, only read while it is on a waitList
+		std::function<void(ProcessID)> createHook;
+		std::function<void(ProcessID)> destroyHook;
+		WaitDiscipline waitDiscipline; // Kept across init()
+		PriorityProtocol priorityProtocol; // Kept across init()
+		std::array<PriorityID, ResourceID::MAX_EXCLUSIVE> ceilings;
+		std::array<std::optional<ResourceID>, ProcessID::MAX_EXCLUSIVE> blockedOn; // Resource a blocked process waits for, none when blocked outside of System
+		uint32_t cpuCount; // Kept across init()
+		uint32_t currentCpu;
+		std::array<uint32_t, ProcessID::MAX_EXCLUSIVE> cpuOf; // CPU whose readyList holds the process, or held it before it blocked
+		std::array<std::optional<uint32_t>, ProcessID::MAX_EXCLUSIVE> affinity; // Pinned processes are never stolen, process 0 stays on CPU 0
+		uint64_t migrationCount;
+		OutputSink* sink; // Not owned, kept across init()
 };
 bool System::isInstantiated = false;
 
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Append-only log of the System commands run by the shell, to move back and forth in a long trace without replaying it from "in"
+// The commands are kept as text, and every keyframeInterval commands the log keeps a copy-on-write checkpoint of the state before
+// the command, so moving costs restoring one checkpoint and replaying at most keyframeInterval - 1 commands, whatever the distance is
+// Commands added to the shell:
+//	undo [count]: go back count commands, 1 by default
+//	seek <position>: go to the state after the first <position> commands, forward too until a new command drops the ones undone
+class UndoLog
+{
+public:
+	static constexpr uint64_t keyframeInterval = 128;
+
+	UndoLog() :
+		commands{}
+		, entries{}
+		, text{}
+		, keyframes{}
+		, beforeState{}
+		, afterState{}
+		, position{0}
+	{}
+
+	UndoLog(const UndoLog&) = delete;
+	UndoLog& operator=(const UndoLog&) = delete;
+
+	void attach(Shell& shell) // Record the System commands from now on
+	{
+		for (auto& [name, function] : getCommandMap())
+		{
+			const auto command = static_cast<uint8_t>(commands.size());
+			commands.push_back(std::move(function));
+			shell.registerCommand(name, [this, command](System& system, const std::vector<std::string>& arguments){ record(system, command, arguments); });
+		}
+		shell.registerCommand("undo", [this](System& system, const std::vector<std::string>& arguments){ undo(system, arguments); });
+		shell.registerCommand("seek", [this](System& system, const std::vector<std::string>& arguments){ seek(system, arguments); });
+	}
+
+	void undo(System& system, const std::vector<std::string>& arguments)
+	{
+		if (arguments.size() > 1) throw std::runtime_error{"Invalid number of arguments."};
+		const auto count = arguments.empty() ? uint64_t{1} : toPosition(arguments.front());
+		if (count > position) throw std::runtime_error{"Can't undo more commands than were run."};
+		moveTo(system, position - count);
+	}
+
+	void seek(System& system, const std::vector<std::string>& arguments)
+	{
+		checkArgumentSize(arguments, 1);
+		const auto target = toPosition(arguments.front());
+		if (target > entries.size()) throw std::runtime_error{"Position is past the last command."};
+		moveTo(system, target);
+	}
+
+	[[nodiscard]] uint64_t getPosition() const noexcept { return position; } // Commands applied to the system
+	[[nodiscard]] uint64_t getCommandCount() const noexcept { return entries.size(); } // Commands in the log, the ones undone included
+
+private:
+	struct Entry
+	{
+		uint8_t command; // Index in commands
+		bool hasThrown; // After changing the system, replaying it throws again at the same point
+		uint32_t argumentCount;
+		uint64_t textEnd; // Arguments in text up to here, space separated
+	};
+
+	void record(System& system, uint8_t command, const std::vector<std::string>& arguments)
+	{
+		auto keyframe = std::optional<System::Checkpoint>{};
+		if (position % keyframeInterval == 0 && position / keyframeInterval >= keyframes.size()) keyframe = system.checkpoint();
+		const auto before = system.checkpoint(); // O(1), only compared if the command throws
+		auto exception = std::exception_ptr{};
+		try
+		{
+			commands[command](system, arguments);
+		}
+		catch (...)
+		{
+			if (!hasChangedSince(system, before)) throw; // Most commands fail before changing anything, nothing to record
+			exception = std::current_exception();
+		}
+		truncate();
+		if (keyframe.has_value()) keyframes.push_back(std::move(keyframe.value()));
+		for (const auto& argument : arguments) text.append(argument).push_back(' ');
+		entries.push_back({command, exception != nullptr, static_cast<uint32_t>(arguments.size()), text.size()});
+		position++;
+		if (exception != nullptr) std::rethrow_exception(exception);
+	}
+
+	[[nodiscard]] bool hasChangedSince(System& system, const System::Checkpoint& before)
+	{
+		const auto after = system.checkpoint();
+		system.encodeState(afterState);
+		system.restore(before);
+		system.encodeState(beforeState);
+		system.restore(after);
+		return beforeState != afterState;
+	}
+
+	void truncate() // A new command after an undo drops the commands undone
+	{
+		if (position == entries.size()) return;
+		entries.resize(position);
+		text.resize(entries.empty() ? 0 : entries.back().textEnd);
+		keyframes.resize(std::min<size_t>(keyframes.size(), position / keyframeInterval + 1));
+	}
+
+	void moveTo(System& system, uint64_t target)
+	{
+		if (entries.empty()) return;
+		const auto keyframe = std::min<uint64_t>(target / keyframeInterval, keyframes.size() - 1);
+		auto& previousSink = system.getOutputSink(); // Replayed commands already reported their events
+		auto nullSink = NullSink{};
+		system.setOutputSink(nullSink);
+		if (position > target || position < keyframe * keyframeInterval) // Forward within reach is replayed from where the system is
+		{
+			system.restore(keyframes[keyframe]);
+			position = keyframe * keyframeInterval;
+		}
+		auto arguments = std::vector<std::string>{};
+		try
+		{
+			for (; position < target; position++) replay(system, position, arguments);
+		}
+		catch (...)
+		{
+			system.setOutputSink(previousSink);
+			throw;
+		}
+		system.setOutputSink(previousSink);
+	}
+
+	void replay(System& system, uint64_t index, std::vector<std::string>& arguments) const
+	{
+		const auto& entry = entries[index];
+		const auto textBegin = index == 0 ? uint64_t{0} : entries[index - 1].textEnd;
+		arguments.resize(entry.argumentCount);
+		auto begin = textBegin;
+		for (auto& argument : arguments)
+		{
+			const auto end = text.find(' ', begin);
+			argument.assign(text, begin, end - begin);
+			begin = end + 1;
+		}
+		if (!entry.hasThrown) return commands[entry.command](system, arguments);
+		try
+		{
+			commands[entry.command](system, arguments);
+		}
+		catch (const std::exception&) // Expected, the system is left as it was when recorded
+		{
+		}
+	}
+
+	[[nodiscard]] static uint64_t toPosition(std::string_view string)
+	{
+		auto value = uint64_t{0};
+		const auto [end, error] = std::from_chars(string.data(), string.data() + string.size(), value);
+		if (error != std::errc{} || end != string.data() + string.size()) throw std::runtime_error{"Invalid position."};
+		return value;
+	}
+
+	std::vector<CommandFunction> commands; // The System commands the shell had when attached
+	std::vector<Entry> entries;
+	std::string text;
+	std::vector<System::Checkpoint> keyframes; // keyframes[i] is the state before the command i * keyframeInterval
+	std::vector<uint64_t> beforeState; // Reused by hasChangedSince()
+	std::vector<uint64_t> afterState;
+	uint64_t position;
+};
@@ -13,19 +13,35 @@
 #include "Predefined.h"
 #include "PCB.h"
 #include "RCB.h"
+#include "OutputSink.h"
 #include "System.h"
+#include "ReplayCache.h"
 #include "Shell.h"
+#include "Executor.h"
+#include "UndoLog.h"
 
 int main(int argc, const char *const *const argv)
 {
 	auto system = System::getInstance();
 	auto shell = Shell::getInstance();
+	auto executor = ProcessExecutor{};
+	executor.attach(shell);
+	auto undoLog = UndoLog{};
 
 	auto arguments = std::vector<std::string_view>(argv, argv + argc);
 	// The first arguments is always the name of the program
 
 	if (arguments.size() > 2) throw std::runtime_error{"Only a file name or a path to a file contains input info is needed."};
-	else if (arguments.size() == 1) shell.run(system);
+	else if (arguments.size() == 1) // Interactive, the batch modes memoize their replays instead of logging them
+	{
+		undoLog.attach(shell);
+		shell.run(system);
+	}
+	else if (arguments[1] == "-") // Batch mode, ie: generator | project1 -
+	{
+		std::ios::sync_with_stdio(false);
+		shell.run(system, std::cin, std::cout);
+	}
 	else shell.run(system, arguments[1]);
 }
 
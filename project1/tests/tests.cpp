@@ -8,8 +8,14 @@
 #include "Predefined.h"
 #include "PCB.h"
 #include "RCB.h"
+#include "OutputSink.h"
 #include "System.h"
+#include "ReplayCache.h"
 #include "Shell.h"
+#include "Executor.h"
+#include "UndoLog.h"
+#include "FixedSystem.h"
+#include "CommandApplier.h"
 
 TEST_CASE("PCB instantiation")
 {
@@ -30,6 +36,45 @@ TEST_CASE("RCB instantiation")
 	REQUIRE(rcb.id == 0);
 }
 
+TEST_CASE("WaitQueue disciplines")
+{
+	// Arrival order: 1 wants 3 units at level 0, 2 wants 1 at level 0, 3 wants 2 at level 2
+	auto waitQueue = WaitQueue{};
+	waitQueue.push(1, 3, 0);
+	waitQueue.push(2, 1, 0);
+	waitQueue.push(3, 2, 2);
+	REQUIRE(waitQueue == std::list{std::pair<ProcessID, Units>{1, 3}, {2, 1}, {3, 2}});
+
+	const auto selectProcess = [&waitQueue](Units remain, WaitDiscipline discipline) -> std::optional<ProcessID>
+	{
+		const auto waiter = waitQueue.select(remain, discipline);
+		if (!waiter.has_value()) return std::nullopt;
+		return waiter->process;
+	};
+	REQUIRE(selectProcess(2, WaitDiscipline::Fifo) == std::nullopt); // Head of line blocking
+	REQUIRE(selectProcess(3, WaitDiscipline::Fifo) == 1);
+	REQUIRE(selectProcess(2, WaitDiscipline::FirstFit) == 2);
+	REQUIRE(selectProcess(2, WaitDiscipline::Priority) == 3);
+	REQUIRE(selectProcess(1, WaitDiscipline::Priority) == 2);
+	REQUIRE(selectProcess(3, WaitDiscipline::SmallestFirst) == 2);
+
+	// Process 1 is bypassed by small requests until it ages, then the units are held for it
+	for (uint32_t i = 0; i < WaitQueue::agingLimit; i++)
+	{
+		const auto waiter = waitQueue.select(2, WaitDiscipline::SmallestFirst);
+		REQUIRE(waiter.has_value());
+		REQUIRE(waiter->process != 1);
+		waitQueue.pop(waiter.value());
+		waitQueue.push(waiter->process, waiter->units, waiter->priority); // Blocks again
+	}
+	REQUIRE(selectProcess(2, WaitDiscipline::SmallestFirst) == std::nullopt);
+	REQUIRE(selectProcess(3, WaitDiscipline::SmallestFirst) == 1);
+
+	REQUIRE(waitQueue.erase(1));
+	REQUIRE_FALSE(waitQueue.erase(1));
+	REQUIRE(waitQueue.size() == 2);
+}
+
 namespace singleton
 {
 	auto system = System::getInstance();
@@ -214,6 +259,31 @@ TEST_CASE("init()")
 	REQUIRE(readyList[2].empty());
 }
 
+TEST_CASE("init() after a used system")
+{
+	const auto& processes = singleton::system.getProcesses();
+	const auto& readyList = singleton::system.getReadyList();
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+
+	for (int round = 0; round < 3; round++) // Stale rows of the previous round must read as free processes
+	{
+		singleton::system.init({});
+		REQUIRE(processes[0].state == PCB::State::Ready);
+		REQUIRE(processes[0].childs.empty());
+		for (uint32_t i = 1; i < ProcessID::MAX_EXCLUSIVE; i++) REQUIRE(processes[i].state == PCB::State::Free);
+
+		singleton::system.create({"0"});
+		singleton::system.create({"1"});
+		singleton::system.request({"3", "2"});
+		REQUIRE(processes[0].childs == std::vector<ProcessID>{1, 2});
+		REQUIRE(processes[2].resources == std::vector<std::pair<ResourceID, Units>>{{3, 2}});
+		REQUIRE(processes[2].parent == 0);
+		REQUIRE(processes[1].resources.empty());
+		REQUIRE(readyList[1] == std::list<ProcessID>{2});
+	}
+}
+
 TEST_CASE("create() without timeout and priority scheduling")
 {
 	singleton::system.init({});
@@ -286,6 +356,48 @@ TEST_CASE("timeout()")
 	REQUIRE(outputCapture.getOutput() == "process 5 running");
 }
 
+TEST_CASE("blockRunningProcess()/unblockProcess()")
+{
+	singleton::system.init({});
+	const auto& processes = singleton::system.getProcesses();
+	const auto& readyList = singleton::system.getReadyList();
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+
+	REQUIRE_THROWS(singleton::system.blockRunningProcess()); // Process 0 can't block
+
+	auto created = std::vector<ProcessID>{};
+	auto destroyed = std::vector<ProcessID>{};
+	singleton::system.setProcessHooks([&created](ProcessID process){ created.push_back(process); }, [&destroyed](ProcessID process){ destroyed.push_back(process); });
+
+	singleton::system.create({"1"});
+	singleton::system.create({"1"});
+	REQUIRE(created == std::vector<ProcessID>{1, 2});
+
+	// Process 1 blocks, 2 takes over
+	REQUIRE(singleton::system.blockRunningProcess() == 1);
+	REQUIRE(processes[1].state == PCB::State::Blocked);
+	REQUIRE(readyList[1] == std::list<ProcessID>{2});
+	REQUIRE(outputCapture.getOutput() == "process 2 running");
+
+	// Process 1 is back at the tail of its level
+	singleton::system.unblockProcess(1);
+	REQUIRE(processes[1].state == PCB::State::Ready);
+	REQUIRE(readyList[1] == std::list<ProcessID>{2, 1});
+
+	// A blocked child can still be destroyed
+	singleton::system.create({"1"});
+	singleton::system.timeout({});
+	singleton::system.timeout({});
+	REQUIRE(singleton::system.blockRunningProcess() == 3);
+	REQUIRE(readyList[1] == std::list<ProcessID>{2, 1});
+	singleton::system.destroy({"3"});
+	REQUIRE(destroyed == std::vector<ProcessID>{3});
+	REQUIRE(processes[3].state == PCB::State::Free);
+
+	singleton::system.setProcessHooks([](ProcessID){}, [](ProcessID){});
+}
+
 TEST_CASE("create()/destroy() with timeout")
 {
 	singleton::system.init({});
@@ -449,6 +561,389 @@ TEST_CASE("request()/release() with timeout")
 	REQUIRE(resources[3].waitList.empty());
 	REQUIRE(readyList[2] == std::list<ProcessID>{7, 6, 8});
 }
+
+TEST_CASE("request() with several resources")
+{
+	singleton::system.init({});
+	const auto& processes = singleton::system.getProcesses();
+	const auto& resources = singleton::system.getResources();
+	const auto& readyList = singleton::system.getReadyList();
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+
+	singleton::system.create({"1"});
+	REQUIRE_THROWS(singleton::system.request({"1", "1", "2"})); // Missing units
+	REQUIRE_THROWS(singleton::system.request({"1", "1", "1", "1"})); // Same resource twice
+	REQUIRE_THROWS(singleton::system.request({"1", "1", "2", "0"})); // Request 0 units
+
+	// Granted at once
+	singleton::system.request({"0", "1", "3", "2"});
+	REQUIRE(processes[1].resources == std::vector<std::pair<ResourceID, Units>>{{0, 1}, {3, 2}});
+	REQUIRE(outputCapture.getOutput() == "2 units of resource 3 allocated");
+	REQUIRE_THROWS(singleton::system.request({"2", "1", "3", "2"})); // More than the inventory of resource 3
+
+	// Process 2 blocks holding nothing, resource 2 is available but 3 isn't
+	singleton::system.create({"1"});
+	singleton::system.timeout({});
+	singleton::system.request({"2", "2", "3", "2"});
+	REQUIRE(processes[2].state == PCB::State::Blocked);
+	REQUIRE(processes[2].resources.empty());
+	REQUIRE(resources[2].remain == 2);
+	REQUIRE(resources[3].waitList == std::list{std::pair<ProcessID, Units>{2, 2}});
+
+	// Resource 3 is enough now, process 2 moves on to wait for resource 2
+	singleton::system.request({"2", "1"});
+	singleton::system.release({"3", "2"});
+	REQUIRE(processes[2].state == PCB::State::Blocked);
+	REQUIRE(resources[3].waitList.empty());
+	REQUIRE(resources[2].waitList == std::list{std::pair<ProcessID, Units>{2, 2}});
+
+	// Every part fits, process 2 gets all of them
+	singleton::system.release({"2", "1"});
+	REQUIRE(processes[2].state == PCB::State::Ready);
+	REQUIRE(processes[2].resources == std::vector<std::pair<ResourceID, Units>>{{2, 2}, {3, 2}});
+	REQUIRE(resources[2].waitList.empty());
+	REQUIRE(readyList[1] == std::list<ProcessID>{1, 2});
+}
+
+TEST_CASE("request() unblocked on a resource already held")
+{
+	singleton::system.init({});
+	const auto& processes = singleton::system.getProcesses();
+	const auto& resources = singleton::system.getResources();
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+
+	// Process 1 holds a unit of resource 3 and blocks for one more, process 2 holds the rest
+	singleton::system.create({"1"});
+	singleton::system.request({"3", "1"});
+	singleton::system.create({"1"});
+	singleton::system.timeout({});
+	singleton::system.request({"3", "2"});
+	singleton::system.timeout({});
+	singleton::system.request({"3", "1"});
+	REQUIRE(processes[1].state == PCB::State::Blocked);
+
+	// The unit granted on unblock joins the pair process 1 holds instead of adding a second one
+	singleton::system.release({"3", "2"});
+	REQUIRE(processes[1].state == PCB::State::Ready);
+	REQUIRE(processes[1].resources == std::vector<std::pair<ResourceID, Units>>{{3, 2}});
+	REQUIRE(resources[3].remain == 1);
+}
+
+TEST_CASE("release() with a first fit waitList")
+{
+	singleton::system.init({});
+	const auto& processes = singleton::system.getProcesses();
+	const auto& resources = singleton::system.getResources();
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+
+	REQUIRE_THROWS(singleton::system.setWaitDiscipline({"lifo"}));
+	singleton::system.setWaitDiscipline({"firstfit"});
+
+	// Process 1 holds resource 3, process 2 waits for all of it and process 3 for one unit
+	singleton::system.create({"1"});
+	singleton::system.request({"3", "3"});
+	singleton::system.create({"1"});
+	singleton::system.create({"1"});
+	singleton::system.timeout({});
+	singleton::system.request({"3", "3"});
+	singleton::system.request({"3", "1"});
+	REQUIRE(resources[3].waitList == std::list{std::pair<ProcessID, Units>{2, 3}, {3, 1}});
+
+	// The unit released goes to process 3 instead of waiting behind process 2
+	singleton::system.release({"3", "1"});
+	REQUIRE(processes[3].state == PCB::State::Ready);
+	REQUIRE(processes[2].state == PCB::State::Blocked);
+	REQUIRE(resources[3].waitList == std::list{std::pair<ProcessID, Units>{2, 3}});
+
+	singleton::system.setWaitDiscipline({"fifo"});
+}
+
+TEST_CASE("request() with priority inheritance and ceiling")
+{
+	const auto& readyList = singleton::system.getReadyList();
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+
+	// Process 1 at level 0 holds resource 1, process 2 at level 1 creates process 3 at level 2 which blocks on resource 1
+	const auto invert = []
+	{
+		singleton::system.init({});
+		singleton::system.create({"0"});
+		singleton::system.timeout({});
+		singleton::system.request({"1", "1"});
+		singleton::system.create({"1"});
+		singleton::system.create({"2"});
+		singleton::system.request({"1", "1"});
+	};
+
+	REQUIRE_THROWS(singleton::system.setPriorityProtocol({"random"}));
+	invert();
+	REQUIRE(singleton::system.getRunningProcess() == 2); // Priority inversion
+
+	singleton::system.setPriorityProtocol({"inheritance"});
+	invert();
+	REQUIRE(singleton::system.getRunningProcess() == 1); // Runs at the level of process 3
+	REQUIRE(readyList[2] == std::list<ProcessID>{1});
+	singleton::system.release({"1", "1"});
+	REQUIRE(singleton::system.getRunningProcess() == 3);
+	REQUIRE(readyList[0] == std::list<ProcessID>{0, 1});
+
+	singleton::system.setPriorityProtocol({"ceiling"});
+	invert();
+	REQUIRE(singleton::system.getRunningProcess() == 1);
+	singleton::system.release({"1", "1"});
+	REQUIRE(readyList[0] == std::list<ProcessID>{0, 1});
+	singleton::system.destroy({"3"}); // Process 3 is a child of process 2 and runs, destroy itself
+	singleton::system.destroy({"2"});
+	singleton::system.timeout({});
+	REQUIRE(singleton::system.getRunningProcess() == 1);
+	singleton::system.request({"1", "1"}); // The ceiling of resource 1 is level 2 now
+	REQUIRE(readyList[2] == std::list<ProcessID>{1});
+
+	singleton::system.setPriorityProtocol({"none"});
+	REQUIRE(readyList[0] == std::list<ProcessID>{0, 1});
+}
+
+TEST_CASE("release() to a priority waitList after inheritance")
+{
+	singleton::system.init({});
+	const auto& processes = singleton::system.getProcesses();
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+	singleton::system.setWaitDiscipline({"priority"});
+	singleton::system.setPriorityProtocol({"inheritance"});
+
+	// Process 1 holds resource 0, processes 2 then 3 wait for it at level 1 and process 3 holds resource 1
+	singleton::system.create({"1"});
+	singleton::system.request({"0", "1"});
+	singleton::system.create({"1"});
+	singleton::system.create({"1"});
+	singleton::system.timeout({});
+	singleton::system.request({"0", "1"});
+	singleton::system.request({"1", "1"});
+	singleton::system.request({"0", "1"});
+
+	// Process 4 waits for resource 1, the blocked process 3 inherits level 2 while it waits
+	singleton::system.create({"2"});
+	singleton::system.request({"1", "1"});
+	REQUIRE(processes.effectivePriority(3) == 2);
+
+	// The released unit goes to process 3 at its raised level, ahead of the older process 2
+	singleton::system.release({"0", "1"});
+	REQUIRE(processes[3].state == PCB::State::Ready);
+	REQUIRE(processes[2].state == PCB::State::Blocked);
+
+	singleton::system.setPriorityProtocol({"none"});
+	singleton::system.setWaitDiscipline({"fifo"});
+}
+
+TEST_CASE("create()/destroy()/timeout() with several CPUs")
+{
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+
+	REQUIRE_THROWS(singleton::system.setCpuCount({"0"}));
+	REQUIRE_THROWS(singleton::system.setCpuCount({std::to_string(System::maxCpus + 1)}));
+	singleton::system.setCpuCount({"2"});
+	const auto& cpu0 = singleton::system.getReadyList(0);
+	const auto& cpu1 = singleton::system.getReadyList(1);
+	REQUIRE_THROWS(singleton::system.switchCpu({"2"}));
+	REQUIRE_THROWS(singleton::system.create({"0", "2"}));
+
+	// New processes go to the least loaded CPU unless pinned
+	singleton::system.create({"0"});
+	singleton::system.create({"0"});
+	singleton::system.create({"0", "1"});
+	REQUIRE(cpu0[0] == std::list<ProcessID>{0, 2});
+	REQUIRE(cpu1[0] == std::list<ProcessID>{1, 3});
+
+	// Timeout only rotates the current CPU
+	singleton::system.switchCpu({"1"});
+	REQUIRE(singleton::system.getRunningProcess() == 1);
+	singleton::system.timeout({});
+	REQUIRE(singleton::system.getRunningProcess() == 3);
+	REQUIRE(cpu0[0] == std::list<ProcessID>{0, 2});
+
+	// CPU 1 goes idle and steals process 2, process 0 is pinned and running anyway
+	singleton::system.switchCpu({"0"});
+	singleton::system.destroy({"1"});
+	REQUIRE(singleton::system.getMigrationCount() == 0);
+	singleton::system.destroy({"3"});
+	REQUIRE(outputCapture.getOutput(1) == "process 2 migrated from cpu 0 to cpu 1");
+	REQUIRE(singleton::system.getMigrationCount() == 1);
+	REQUIRE(cpu0[0] == std::list<ProcessID>{0});
+	REQUIRE(cpu1[0] == std::list<ProcessID>{2});
+
+	singleton::system.setCpuCount({"1"});
+	REQUIRE(cpu1[0].empty());
+}
+
+TEST_CASE("Commands leaving the current CPU idle")
+{
+	auto system = System::makeSession();
+	auto shell = Shell::makeSession();
+	auto input = std::istringstream{"cpus 2\ncr 1 1\ncpu 1\nde 1\ncpu 1\ncr 1\nto\ncpu 0\n"};
+	auto output = std::ostringstream{};
+	shell.run(system, input, output);
+	REQUIRE(output.str() == "0 0 1 -1 -1 -1 -1 0\n");
+
+	REQUIRE(system.getProcesses()[1].state == PCB::State::Free);
+	REQUIRE(system.getReadyList(0)[0] == std::list<ProcessID>{0});
+
+	// The destroy and the switches succeed, create and timeout have no running process to act for and change nothing
+	system.create({"1", "1"});
+	system.switchCpu({"1"});
+	REQUIRE_NOTHROW(system.destroy({"1"}));
+	REQUIRE_NOTHROW(system.switchCpu({"1"}));
+	REQUIRE(system.getCurrentCpu() == 1);
+	REQUIRE_THROWS_WITH(system.create({"1"}), "None of the process is ready.");
+	REQUIRE_THROWS_WITH(system.timeout({}), "None of the process is ready.");
+	REQUIRE(system.getProcesses()[1].state == PCB::State::Free);
+	REQUIRE(system.getReadyList(1)[0].empty());
+}
+
+TEST_CASE("checkpoint()/restore()")
+{
+	auto system = System::makeSession();
+	auto nullSink = NullSink{};
+	system.setOutputSink(nullSink);
+	system.setCpuCount({"2"});
+	system.create({"1"}); // Process 1 on cpu 1
+	system.create({"2"}); // Process 2 on cpu 0
+	system.request({"3", "2"});
+	const auto checkpoint = system.checkpoint();
+	const auto* cpu1 = &system.getReadyList(1);
+
+	// Only what is written moves off the checkpoint
+	system.release({"3", "2"});
+	system.destroy({"2"});
+	REQUIRE(&system.getReadyList(1) == cpu1);
+	REQUIRE(system.getRunningProcess() == 0);
+	REQUIRE(system.getResources()[3].remain == 3);
+
+	system.restore(checkpoint);
+	REQUIRE(system.getRunningProcess() == 2);
+	REQUIRE(system.getResources()[3].remain == 1);
+	REQUIRE(system.getProcesses()[2].resources.size() == 1);
+	system.timeout({});
+	REQUIRE(system.getRunningProcess() == 2);
+	REQUIRE(checkpoint.processes[2].state == PCB::State::Ready); // Untouched by either continuation
+
+	system.restore(checkpoint); // Any number of times
+	system.destroy({"2"});
+	REQUIRE(system.getRunningProcess() == 0);
+	REQUIRE(system.getResources()[3].remain == 3);
+	REQUIRE(system.getReadyList(1)[1] == std::list<ProcessID>{1});
+}
+
+TEST_CASE("CommandApplier with several submitters")
+{
+	singleton::system.init({});
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+	auto nullSink = NullSink{};
+	singleton::system.setOutputSink(nullSink);
+	constexpr auto submitterCount = 4;
+	constexpr auto roundCount = 200;
+	auto results = std::vector<std::vector<CommandApplier::Result>>(submitterCount);
+	{
+		auto applier = CommandApplier{singleton::system};
+		auto submitters = std::vector<std::jthread>{};
+		for (int submitter = 0; submitter < submitterCount; submitter++)
+		{
+			submitters.emplace_back([&, submitter]
+			{
+				auto tickets = std::vector<CommandApplier::Ticket>{};
+				for (int round = 0; round < roundCount; round++) // Submitted without waiting for the results
+				{
+					tickets.push_back(applier.submit({"cr", "0"}));
+					tickets.push_back(applier.submit({"to"}));
+					tickets.push_back(applier.submit({"xx"}));
+				}
+				for (const auto& ticket : tickets) results[submitter].push_back(ticket.wait());
+			});
+		}
+		submitters.clear(); // Join
+		REQUIRE(applier.getBatchCount() >= 1);
+		REQUIRE_THROWS(applier.submit({}));
+	}
+	singleton::system.setOutputSink(singleton::system.getDefaultOutputSink());
+
+	auto sequences = std::vector<uint64_t>{};
+	for (const auto& submitterResults : results)
+	{
+		REQUIRE(submitterResults.size() == 3 * roundCount);
+		for (size_t i = 0; i < submitterResults.size(); i++)
+		{
+			if (i != 0) REQUIRE(submitterResults[i - 1].sequence < submitterResults[i].sequence); // Applied in submission order
+			if (i % 3 == 1) REQUIRE(submitterResults[i].error.empty()); // Creates fail once the table is full, timeouts never do
+			if (i % 3 == 2) REQUIRE(submitterResults[i].error == "Invalid command.");
+			sequences.push_back(submitterResults[i].sequence);
+		}
+	}
+	std::ranges::sort(sequences);
+	REQUIRE(sequences.size() == submitterCount * roundCount * 3);
+	for (size_t i = 0; i < sequences.size(); i++) REQUIRE(sequences[i] == i); // Every command applied once
+	singleton::system.init({});
+}
+
+TEST_CASE("OutputSink")
+{
+	singleton::system.init({});
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+	auto text = std::ostringstream{};
+	auto binary = std::ostringstream{};
+	auto textBeforeFlush = std::string{};
+	auto binaryBeforeFlush = std::string{};
+	{
+		auto nullSink = NullSink{};
+		singleton::system.setOutputSink(nullSink);
+		singleton::system.create({"1"}); // Process 1
+		auto textSink = BufferedTextSink{text, 1}; // Room for one line, flushes before every event
+		singleton::system.setOutputSink(textSink);
+		singleton::system.request({"3", "2"});
+		singleton::system.create({"2"}); // Process 2
+		textBeforeFlush = text.str();
+		auto binarySink = BinarySink{binary};
+		singleton::system.setOutputSink(binarySink);
+		singleton::system.setWaitDiscipline({"priority"});
+		binaryBeforeFlush = binary.str();
+		singleton::system.setOutputSink(singleton::system.getDefaultOutputSink());
+	}
+	singleton::system.setWaitDiscipline({"fifo"});
+	REQUIRE(textBeforeFlush == "2 units of resource 3 allocated\nprocess 2 created\n");
+	REQUIRE(text.str() == "2 units of resource 3 allocated\nprocess 2 created\nprocess 2 running\n");
+	REQUIRE(binaryBeforeFlush.empty());
+	REQUIRE(binary.str() == std::string{static_cast<char>(Event::Kind::WaitDiscipline), static_cast<char>(WaitDiscipline::Priority), 0, 0});
+}
+
+TEST_CASE("ProcessExecutor dispatch")
+{
+	singleton::system.init({});
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+	auto executor = ProcessExecutor{};
+	REQUIRE_THROWS(executor.setIterations({"-1"}));
+	REQUIRE_FALSE(executor.isEnabled());
+
+	executor.setIterations({"1000"});
+	singleton::system.create({"1"});
+	singleton::system.request({"3", "2"});
+	executor.dispatch(singleton::system); // Process 1 acquires its units on resource 3
+	singleton::system.release({"3", "2"});
+	singleton::system.timeout({});
+	executor.dispatch(singleton::system);
+	REQUIRE(executor.getStatistics().dispatches == 2);
+	REQUIRE(executor.getStatistics().contextSwitches == 0);
+
+	executor.setIterations({"0"});
+	REQUIRE_FALSE(executor.isEnabled());
+	REQUIRE(executor.getStatistics().dispatches == 0);
+}
 // ADVANCE ============
 
 //// RANDOM ============
@@ -542,11 +1037,254 @@ TEST_CASE("random four")
 // RANDOM ============
 // ============ SYSTEM ============
 
+TEST_CASE("run() in batch mode with a ReplayCache")
+{
+	const auto trace = std::string{"in\ncr 2\ncr 1\nrq 3 2\nto\n\nin\ncr 2\ncr 1\nrq 3 2\nde 1\n\nwq priority\n\nin\ncr 2\ncr 1\n"};
+	auto expected = std::ostringstream{};
+	{
+		auto system = System::makeSession();
+		auto shell = Shell::makeSession();
+		shell.setCommandHook([](System&){}); // A hook turns the memoization off
+		auto input = std::istringstream{trace};
+		shell.run(system, input, expected);
+	}
+	REQUIRE(expected.str() == "0 1 1 1 1\n0 1 1 1 0\n0\n0 1 1\n");
+
+	auto system = System::makeSession();
+	auto shell = Shell::makeSession();
+	auto input = std::istringstream{trace};
+	auto output = std::ostringstream{};
+	shell.run(system, input, output);
+	REQUIRE(output.str() == expected.str());
+	system.destroy({"1"}); // The system caught up with the last sequence
+	REQUIRE(system.getRunningProcess() == 0);
+
+	auto cache = ReplayCache{};
+	auto runCount = 0;
+	const auto runTimeout = [&runCount](System& target){ runCount++; target.timeout({}); return static_cast<int32_t>(static_cast<uint32_t>(target.getRunningProcess())); };
+	system.init({});
+	system.create({"1"});
+	system.create({"1"});
+	for (int sequence = 0; sequence < 3; sequence++)
+	{
+		system.restore(System::makeSession().checkpoint()); // Same state before every sequence
+		system.create({"1"});
+		system.create({"1"});
+		cache.beginSequence(system);
+		REQUIRE(cache.replay(system, "to ", runTimeout) == 2);
+		REQUIRE(cache.replay(system, "to ", runTimeout) == 1);
+	}
+	REQUIRE(runCount == 2);
+	REQUIRE(cache.getHitCount() == 4);
+	REQUIRE(cache.getNodeCount() == 3);
+	cache.sync(system);
+	REQUIRE(system.getReadyList()[1] == std::list<ProcessID>{1, 2});
+	REQUIRE(cache.getByteSize() > 0);
+	REQUIRE(cache.getByteSize() <= ReplayCache::maxBytes);
+
+	// in roots the trie, the sequences after it share their prefix whatever the previous sequence left
+	{
+		auto system = System::makeSession();
+		auto shell = Shell::makeSession();
+		auto input = std::istringstream{"in\ncr 2\ncr 1\nto\n\nin\ncr 2\ncr 1\nto\n"};
+		auto output = std::ostringstream{};
+		shell.run(system, input, output);
+		REQUIRE(output.str() == "0 1 1 1\n0 1 1 1\n");
+		REQUIRE(shell.getReplayCache().getHitCount() == 3);
+	}
+
+	// A sink chosen by the caller gets the events of every command, nothing is replayed
+	{
+		auto system = System::makeSession();
+		auto shell = Shell::makeSession();
+		auto events = std::ostringstream{};
+		auto textSink = BufferedTextSink{events};
+		system.setOutputSink(textSink);
+		auto input = std::istringstream{"in\ncr 1\n\nin\ncr 1\n\nin\ncr 1\n"};
+		auto output = std::ostringstream{};
+		shell.run(system, input, output);
+		textSink.flush();
+		REQUIRE(output.str() == "0 1\n0 1\n0 1\n");
+		const auto text = events.str();
+		auto createdCount = 0;
+		for (auto position = text.find("process 1 created"); position != std::string::npos; position = text.find("process 1 created", position + 1)) createdCount++;
+		REQUIRE(createdCount == 3);
+		REQUIRE(shell.getReplayCache().getHitCount() == 0);
+		system.setOutputSink(system.getDefaultOutputSink());
+	}
+}
+
+TEST_CASE("UndoLog undo and seek")
+{
+	auto system = System::makeSession();
+	auto shell = Shell::makeSession();
+	auto undoLog = UndoLog{};
+	undoLog.attach(shell);
+	const auto runLine = [&](const std::string& line)
+	{
+		auto input = std::istringstream{line};
+		auto output = std::ostringstream{};
+		shell.run(system, input, output);
+		return output.str();
+	};
+
+	// Several keyframes of commands, some of them failing and not logged
+	const auto commands = std::array<std::string, 8>{"cr 1", "cr 2", "to", "rq 3 1", "rl 3 1", "de 1", "xx", "in"};
+	auto hashes = std::vector<uint64_t>{system.hashState()};
+	auto state = uint64_t{7};
+	for (int i = 0; i < 800; i++)
+	{
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		if (runLine(commands[(state >> 33) % commands.size()]) != "-1\n") hashes.push_back(system.hashState());
+	}
+	REQUIRE(undoLog.getCommandCount() == hashes.size() - 1);
+	REQUIRE(undoLog.getPosition() == undoLog.getCommandCount());
+
+	for (const auto target : {uint64_t{400}, uint64_t{0}, uint64_t{129}, uint64_t{130}, uint64_t{300}, uint64_t{128}, undoLog.getCommandCount()})
+	{
+		runLine("seek " + std::to_string(target));
+		REQUIRE(undoLog.getPosition() == target);
+		REQUIRE(system.hashState() == hashes[target]);
+	}
+	runLine("undo 3");
+	REQUIRE(system.hashState() == hashes[hashes.size() - 4]);
+	runLine("undo");
+	REQUIRE(system.hashState() == hashes[hashes.size() - 5]);
+	REQUIRE(runLine("seek " + std::to_string(hashes.size())) == "-1\n");
+	REQUIRE(runLine("undo " + std::to_string(hashes.size())) == "-1\n");
+	REQUIRE(runLine("seek 1.5") == "-1\n");
+
+	// A new command drops the commands undone
+	runLine("seek 10");
+	runLine("in");
+	REQUIRE(undoLog.getCommandCount() == 11);
+	runLine("undo");
+	REQUIRE(system.hashState() == hashes[10]);
+}
+
+TEST_CASE("UndoLog records a command that threw after changing the system")
+{
+	auto system = System::makeSession();
+	auto shell = Shell::makeSession();
+	auto undoLog = UndoLog{};
+	undoLog.attach(shell);
+	system.setProcessHooks([](ProcessID){}, [](ProcessID process){ if (process == 2) throw std::runtime_error{"Hook failed."}; });
+	const auto runLine = [&](const std::string& line)
+	{
+		auto input = std::istringstream{line};
+		auto output = std::ostringstream{};
+		shell.run(system, input, output);
+		return output.str();
+	};
+
+	runLine("cr 1");
+	runLine("cr 1"); // Process 2, child of process 1
+	const auto beforeDestroy = system.hashState();
+	REQUIRE(runLine("de 1") == "-1\n"); // Process 1 is unlinked from process 0 before the hook throws on its child
+	const auto afterDestroy = system.hashState();
+	REQUIRE(afterDestroy != beforeDestroy);
+	REQUIRE(undoLog.getCommandCount() == 3);
+	REQUIRE(runLine("de 0") == "-1\n"); // Rejected before any change, not logged
+	REQUIRE(undoLog.getCommandCount() == 3);
+
+	runLine("undo");
+	REQUIRE(system.hashState() == beforeDestroy);
+	runLine("seek 3"); // Replayed, it throws at the same point again
+	REQUIRE(undoLog.getPosition() == 3);
+	REQUIRE(system.hashState() == afterDestroy);
+	runLine("seek 0");
+	runLine("seek 3");
+	REQUIRE(system.hashState() == afterDestroy);
+}
+
+namespace
+{
+	using SmallSystem = fixed::System<ProcessID::MAX_EXCLUSIVE, ResourceID::MAX_EXCLUSIVE, PriorityID::MAX_EXCLUSIVE>;
+	constexpr auto smallInventory = std::array<SmallSystem::Units, ResourceID::MAX_EXCLUSIVE>{1, 1, 2, 3};
+
+	template<size_t N>
+	constexpr auto replayFixed(std::string_view trace)
+	{
+		auto system = SmallSystem{smallInventory};
+		auto answers = std::array<int32_t, N>{};
+		auto count = size_t{0};
+		system.runTrace(trace, [&](int32_t answer){ answers[count++] = answer; });
+		return answers;
+	}
+
+	// First sequence of input.txt and its line of output.txt, evaluated by the compiler
+	constexpr auto embeddedAnswers = replayFixed<17>("in\ncr 2\ncr 2\ncr 1\nto\ncr 1\ncr 1\ncr 2\nto\nto\nto\nde 4\nde 5\nde 6\nto\nto\nto\n");
+	static_assert(embeddedAnswers == std::array<int32_t, 17>{0, 1, 1, 1, 2, 2, 2, 2, 1, 6, 2, 2, 2, 2, 1, 2, 1});
+	static_assert(replayFixed<6>("in\ncr 1\nrq 3 4\nrq 3 3.0\nrl 3 1.5\nde 0\n") == std::array<int32_t, 6>{0, 1, -1, 1, -1, -1});
+	static_assert(sizeof(SmallSystem) <= 6 * 64);
+	static_assert(std::is_same_v<SmallSystem::Process, uint8_t> && std::is_same_v<fixed::System<300, 2, 2>::Process, uint16_t>);
+}
+
+TEST_CASE("fixed::System answers like System")
+{
+	auto system = System::makeSession();
+	auto shell = Shell::makeSession();
+	auto fixedSystem = SmallSystem{smallInventory};
+	const auto commands = std::array<std::string, 12>{"cr 1", "cr 2", "cr 0", "to", "de 1", "de 2", "de 3", "rq 2 1", "rq 3 2", "rl 2 1", "rl 3 1", "rq 1 1"};
+	auto trace = std::string{};
+	auto state = uint64_t{11};
+	for (int i = 0; i < 5000; i++)
+	{
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		trace += i % 500 == 0 ? "in" : commands[(state >> 33) % commands.size()];
+		trace += '\n';
+	}
+	auto input = std::istringstream{trace};
+	auto output = std::ostringstream{};
+	shell.run(system, input, output);
+	auto expected = std::istringstream{output.str()};
+	auto answerCount = 0;
+	fixedSystem.runTrace(trace, [&](int32_t answer)
+	{
+		auto systemAnswer = int32_t{};
+		expected >> systemAnswer;
+		REQUIRE(answer == systemAnswer);
+		answerCount++;
+	});
+	REQUIRE(answerCount == 5000);
+	for (uint32_t process = 0; process < ProcessID::MAX_EXCLUSIVE; process++)
+	{
+		const auto pcb = system.getProcesses()[process];
+		REQUIRE(static_cast<uint8_t>(pcb.state) == static_cast<uint8_t>(fixedSystem.getState(process)));
+		for (const auto& [resource, units] : pcb.resources) REQUIRE(fixedSystem.getHeldUnits(process, resource) == units);
+	}
+}
+
 // ============ SHELL ============
 TEST_CASE("Shell instantiation")
 {
 	REQUIRE(Shell::isInstantiated);
 }
+
+TEST_CASE("makeSession()")
+{
+	singleton::system.init({});
+	auto system = System::makeSession(); // Independent of the singletons
+	auto shell = Shell::makeSession();
+	auto input = std::istringstream{"cr 1\ncr 2\n"};
+	auto output = std::ostringstream{};
+	shell.run(system, input, output);
+	REQUIRE(output.str() == "1 2\n");
+	REQUIRE(singleton::system.getProcesses()[1].state == PCB::State::Free);
+}
+
+TEST_CASE("run() in batch mode")
+{
+	singleton::system.init({});
+	auto outputCapture = OutputCapture{};
+	outputCapture.capture();
+	auto input = std::istringstream{"in\ncr 1\n\r\nin\n   \ncr 1 \t\nto\nxx 1\nrq 3 2"}; // Blank lines split the sequences, the last line has no new line
+	auto output = std::ostringstream{};
+	singleton::shell.run(singleton::system, input, output);
+	REQUIRE(output.str() == "0 1\n0 -1 1 1 -1 1\n");
+	REQUIRE_THROWS(outputCapture.getOutput()); // Events are dropped, nothing was printed
+	REQUIRE(&singleton::system.getOutputSink() == &singleton::system.getDefaultOutputSink());
+}
 // ============ SHELL ============
 
 
@@ -571,7 +1309,7 @@ TEST_CASE("Shell instantiation")
 // Releasing a resource the process is not holding
 // Process 0 should be prevented from requesting any resource to avoid 
 //deadlock where no process is on the RL
-// In each case, the corresponding function should display error (e.g. -1
+// In each case, the corresponding function should display error (e.g. -1
 //
 //
 //Test case
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Blocking FIFO between two pipeline stages, producers wait while it is full and consumers wait while it is empty
+// Closing wakes everybody up: push() fails from then on and pop() drains what is left before failing
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t inCapacity) :
+		items{}
+		, capacity{inCapacity}
+		, isClosed{false}
+	{}
+
+	[[nodiscard]] bool push(T item)
+	{
+		auto lock = std::unique_lock{mutex};
+		notFull.wait(lock, [this]{ return isClosed || items.size() < capacity; });
+		if (isClosed) return false;
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	[[nodiscard]] std::optional<T> pop()
+	{
+		auto lock = std::unique_lock{mutex};
+		notEmpty.wait(lock, [this]{ return isClosed || !items.empty(); });
+		if (items.empty()) return std::nullopt;
+		auto item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return item;
+	}
+
+	void close()
+	{
+		auto lock = std::lock_guard{mutex};
+		isClosed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	std::deque<T> items;
+	size_t capacity;
+	bool isClosed;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+// Page mappings of every address space in one open addressing table keyed by (address space, segment, page), in place of a PT frame
+// per segment. Linear probing over a flat array of 8 byte slots: a lookup is one hash and usually one cache line
+// Sized by the physical frames, as there is at most one resident page per frame. Pages on the disk keep their block (negative frame)
+// and grow the table past that
+class InvertedPageTable
+{
+public:
+	explicit InvertedPageTable(uint32_t frameCount) :
+		slots(std::bit_ceil(frameCount * 2)) // Half full at most
+		, shift{static_cast<uint32_t>(32 - std::countr_zero(std::bit_ceil(frameCount * 2)))}
+		, size{0}
+	{}
+
+	[[nodiscard]] static constexpr uint32_t makeKey(uint32_t addressSpace, uint32_t segment, uint32_t page) noexcept
+	{
+		return (addressSpace << 18) | (segment << 9) | page;
+	}
+	[[nodiscard]] static constexpr uint32_t getAddressSpace(uint32_t key) noexcept { return key >> 18; }
+	[[nodiscard]] static constexpr uint32_t getSegment(uint32_t key) noexcept { return (key >> 9) & 0x1FF; }
+
+	[[nodiscard]] const int* find(uint32_t key) const noexcept // Null if the page was never mapped
+	{
+		for (auto slot = getSlot(key); ; slot = (slot + 1) & (slots.size() - 1))
+		{
+			if (slots[slot].tag == key + 1) return &slots[slot].frame;
+			if (slots[slot].tag == 0) return nullptr;
+		}
+	}
+
+	void insertOrAssign(uint32_t key, int frame)
+	{
+		if ((size + 1) * 2 > slots.size()) grow();
+		auto slot = getSlot(key);
+		for (; slots[slot].tag != 0; slot = (slot + 1) & (slots.size() - 1))
+		{
+			if (slots[slot].tag != key + 1) continue;
+			slots[slot].frame = frame;
+			return;
+		}
+		slots[slot] = Slot{key + 1, frame};
+		size++;
+	}
+
+	template<typename Predicate>
+	void eraseIf(Predicate predicate) // predicate(key, frame), the remaining mappings are probed in again so no tombstone is left
+	{
+		auto previous = std::move(slots);
+		slots.assign(previous.size(), Slot{});
+		size = 0;
+		for (const auto& slot : previous)
+		{
+			if (slot.tag != 0 && !predicate(slot.tag - 1, slot.frame)) place(slot);
+		}
+	}
+
+	[[nodiscard]] size_t getSize() const noexcept { return size; }
+	[[nodiscard]] size_t getByteSize() const noexcept { return slots.size() * sizeof(Slot); }
+
+private:
+	struct Slot
+	{
+		uint32_t tag; // key + 1, 0 for an empty slot
+		int frame;
+	};
+
+	[[nodiscard]] size_t getSlot(uint32_t key) const noexcept
+	{
+		return (key * 0x9E3779B1u) >> shift; // Fibonacci hashing, neighbouring pages spread over the table
+	}
+
+	void place(const Slot& entry) noexcept // The key isn't in the table and a slot is free
+	{
+		auto slot = getSlot(entry.tag - 1);
+		while (slots[slot].tag != 0) slot = (slot + 1) & (slots.size() - 1);
+		slots[slot] = entry;
+		size++;
+	}
+
+	void grow()
+	{
+		auto previous = std::move(slots);
+		slots.assign(previous.size() * 2, Slot{});
+		shift--;
+		size = 0;
+		for (const auto& slot : previous)
+		{
+			if (slot.tag != 0) place(slot);
+		}
+	}
+
+	std::vector<Slot> slots;
+	uint32_t shift; // 32 - log2(slots.size())
+	size_t size;
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <filesystem>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#define MAPPED_FILE_POSIX
+#else
+	#include <algorithm>
+	#include <fstream>
+	#include <vector>
+#endif
+
+// A region of memory backed by a file (or by nothing, for anonymous regions)
+// Shared: writes go back to the file, the file is created/grown to the requested size
+// Private: copy-on-write view of an existing file, concurrent instances share the clean pages and the file is never modified
+class MappedFile
+{
+public:
+	enum class Mode : uint8_t {Anonymous, Shared, Private};
+
+	MappedFile() = default;
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept { swap(other); }
+	MappedFile& operator=(MappedFile&& other) noexcept
+	{
+		MappedFile{std::move(other)}.swap(*this); // Unmap the current region through the temporary
+		return *this;
+	}
+
+	~MappedFile() { unmap(); }
+
+	[[nodiscard]] static MappedFile anonymous(size_t size)
+	{
+		auto file = MappedFile{};
+		file.mode = Mode::Anonymous;
+		file.size = size;
+#ifdef MAPPED_FILE_POSIX
+		void* address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (address == MAP_FAILED) throw std::runtime_error{"Failed to allocate an anonymous mapping."};
+		file.address = static_cast<std::byte*>(address);
+#else
+		file.buffer.resize(size);
+		file.address = file.buffer.data();
+#endif
+		return file;
+	}
+
+	[[nodiscard]] static MappedFile open(const std::filesystem::path& path, size_t size, Mode mode) // size == 0 maps the whole (existing) file
+	{
+		if (mode == Mode::Anonymous) return anonymous(size);
+		if (mode == Mode::Private && !std::filesystem::exists(path)) throw std::runtime_error{"Mapped file doesn't exist."};
+		auto file = MappedFile{};
+		file.mode = mode;
+		file.path = path;
+#ifdef MAPPED_FILE_POSIX
+		const int fd = ::open(path.c_str(), mode == Mode::Shared ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+		if (fd < 0) throw std::runtime_error{"Failed to open mapped file."};
+		struct stat status{};
+		if (::fstat(fd, &status) != 0)
+		{
+			::close(fd);
+			throw std::runtime_error{"Failed to stat mapped file."};
+		}
+		const auto fileSize = static_cast<size_t>(status.st_size);
+		file.size = size == 0 ? fileSize : size;
+		if (mode == Mode::Shared && fileSize < file.size && ::ftruncate(fd, static_cast<off_t>(file.size)) != 0)
+		{
+			::close(fd);
+			throw std::runtime_error{"Failed to grow mapped file."};
+		}
+		if (file.size == 0 || (mode == Mode::Private && fileSize < file.size))
+		{
+			::close(fd);
+			throw std::runtime_error{"Mapped file is smaller than requested."};
+		}
+		void* address = ::mmap(nullptr, file.size, PROT_READ | PROT_WRITE, mode == Mode::Shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+		::close(fd); // The mapping keeps its own reference to the file
+		if (address == MAP_FAILED) throw std::runtime_error{"Failed to map file."};
+		file.address = static_cast<std::byte*>(address);
+#else
+		const auto fileSize = std::filesystem::exists(path) ? static_cast<size_t>(std::filesystem::file_size(path)) : size_t{0};
+		file.size = size == 0 ? fileSize : size;
+		if (file.size == 0 || (mode == Mode::Private && fileSize < file.size)) throw std::runtime_error{"Mapped file is smaller than requested."};
+		file.buffer.resize(file.size);
+		auto stream = std::ifstream{path, std::ios::binary};
+		stream.read(reinterpret_cast<char*>(file.buffer.data()), static_cast<std::streamsize>(std::min(fileSize, file.size)));
+		file.address = file.buffer.data();
+#endif
+		return file;
+	}
+
+	[[nodiscard]] std::byte* data() const noexcept { return address; }
+	[[nodiscard]] size_t getSize() const noexcept { return size; }
+	[[nodiscard]] bool isMapped() const noexcept { return address != nullptr; }
+	[[nodiscard]] Mode getMode() const noexcept { return mode; }
+
+	template<typename T>
+	[[nodiscard]] std::span<T> view(size_t byteOffset, size_t count) const
+	{
+		if (byteOffset + count * sizeof(T) > size) throw std::runtime_error{"View is out of the mapped region."};
+		return {reinterpret_cast<T*>(address + byteOffset), count};
+	}
+
+	void sync() // Flush a shared mapping back to its file
+	{
+		if (mode != Mode::Shared || address == nullptr) return;
+#ifdef MAPPED_FILE_POSIX
+		::msync(address, size, MS_SYNC);
+#else
+		auto stream = std::ofstream{path, std::ios::binary};
+		stream.write(reinterpret_cast<const char*>(address), static_cast<std::streamsize>(size));
+#endif
+	}
+
+private:
+	void unmap() noexcept
+	{
+		if (address == nullptr) return;
+#ifdef MAPPED_FILE_POSIX
+		::munmap(address, size);
+#else
+		try { sync(); } catch (...) {} // Write back the buffer of a shared file
+		buffer.clear();
+#endif
+		address = nullptr;
+		size = 0;
+	}
+
+	void swap(MappedFile& other) noexcept
+	{
+		std::swap(address, other.address);
+		std::swap(size, other.size);
+		std::swap(mode, other.mode);
+		std::swap(path, other.path);
+#ifndef MAPPED_FILE_POSIX
+		std::swap(buffer, other.buffer);
+#endif
+	}
+
+	std::byte* address{nullptr};
+	size_t size{0};
+	Mode mode{Mode::Anonymous};
+	std::filesystem::path path{};
+#ifndef MAPPED_FILE_POSIX
+	std::vector<std::byte> buffer{};
+#endif
+};
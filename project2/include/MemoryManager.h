@@ -1,6 +1,7 @@
 #include <filesystem>
 #include <fstream>
 #include <exception>
+#include <stdexcept>
 #include <string>
 #include <array>
 #include <vector>
@@ -8,64 +9,583 @@
 #include <cassert>
 #include <algorithm>
 #include <iterator>
+#include <memory>
+#include <charconv>
+#include <functional>
+#include <cstdio>
+#include <span>
+#include <thread>
+#include <unordered_map>
+
+#include "MappedFile.h"
+#include "BoundedQueue.h"
+#include "Profiler.h"
+#include "Tlb.h"
+#include "InvertedPageTable.h"
 
 // The starting location of a segment's PT = physicalMemory[getSegmentFrameLocation(segmentNumber)] * 512
 // The starting location of a segment's page = physicalMemory[getWordLocation(segmentNumber, pageNumber, 0)]
+// Every address space has its own ST (2 frames), address space 0 keeps its ST at PM[0, 1024)
+
+using AddressSpaceID = uint32_t;
 
 class MemoryManager
 {
 public:
-	MemoryManager() :
-		physicalMemory(1024 * 512, -1) // 1024 frames, each frame has 512 words
-		, disk(1024, std::vector<int>(512, -1)) // 1024 blocks, each block has 512 words
-		, freeFrames(1024, true) // Keep track of the free frames in the physical memory, assuming that a free frame is always available
-	{}
+	static constexpr uint32_t frameCount = 1024; // Frames in the physical memory
+	static constexpr uint32_t frameSize = 512; // Words per frame, also words per disk block
+	static constexpr uint32_t defaultDiskBlocks = 1024;
+	static constexpr uint32_t segmentTableFrames = 2; // PM[0, 1024) holds the ST of 512 segments
+	static constexpr int largeSegmentFlag = 1 << 30; // PM[2s + 1] = flag | f: the whole segment lives in the contiguous frames starting at f, no PT
+	static constexpr int invertedSegmentFlag = 1 << 29; // PM[2s + 1] = flag: the pages of the segment are mapped by the inverted page table, no PT
+
+	struct SegmentInfo // A segment at 'frame' owns multiples pages. The pages are resided at different frame and may/may not be contiguous to one another
+	{
+		uint32_t number; // Segment number index
+		uint32_t size; // Size of the segment in term of word
+		int frame; // Residing location, positive if on physical memory, negative if on disk
+	};
+	struct PageInfo
+	{
+		uint32_t segment; // Owner
+		uint32_t number; // Page number index
+		int frame; // Residing location, positive if on physical memory, negative if on disk
+	};
+	struct AddressSpaceLayout // Parsed content of an init file
+	{
+		std::vector<SegmentInfo> segments;
+		std::vector<PageInfo> pages;
+	};
 
-    void init(std::filesystem::path initFilePath)
+	MemoryManager(uint32_t diskBlocks = defaultDiskBlocks) :
+		memoryImage{MappedFile::anonymous(snapshotDiskOffset)} // Physical memory and free frames, laid out like the head of a snapshot
+		, physicalMemory{}
+		, diskImage{MappedFile::anonymous(getDiskImageSize(diskBlocks))} // Not backed by any file, gone at exit
+		, disk{}
+		, freeFrames{}
+		, initHash{0}
+		, profiler{}
+		, segmentTableRoots{0}
+		, activeAddressSpace{0}
+		, tlb{}
+		, invertedPageTable{}
+	{
+		mountMemory();
+		mountDisk(diskBlocks);
+	}
+
+	// Disk backed by an image file, see MappedFile::Mode. diskBlocks sizes a fresh image, an existing one keeps its own geometry and
+	// throws if diskBlocks disagrees with it
+	MemoryManager(const std::filesystem::path& diskImagePath, MappedFile::Mode mode, std::optional<uint32_t> diskBlocks = std::nullopt) :
+		memoryImage{MappedFile::anonymous(snapshotDiskOffset)}
+		, physicalMemory{}
+		, diskImage{openDiskImage(diskImagePath, mode, diskBlocks)}
+		, disk{}
+		, freeFrames{}
+		, initHash{0}
+		, profiler{}
+		, segmentTableRoots{0}
+		, activeAddressSpace{0}
+		, tlb{}
+		, invertedPageTable{}
+	{
+		mountMemory();
+		mountDisk(diskBlocks.value_or(defaultDiskBlocks));
+	}
+
+    void init(std::filesystem::path initFilePath) // Initialize the active address space, both lines are parsed before anything is applied
     {
-		auto inputFile = std::ifstream{initFilePath};
-		if (!inputFile) throw std::runtime_error{"Invalid input file."};
-		auto segmentCommand = std::string{};
-		auto pageCommand = std::string{};
-		if (!std::getline(inputFile, segmentCommand)) throw std::runtime_error{"Failed to get input command to initialize a segment table."};
-		if (!std::getline(inputFile, pageCommand)) throw std::runtime_error{"Failed to get input command to initialize page tables."};
-		const auto segmentInfos = toInfos<SegmentInfo>(tokenizeCommand(segmentCommand));
-		const auto pageInfos = toInfos<PageInfo>(tokenizeCommand(pageCommand));
-		initPhysicalMemory(segmentInfos, pageInfos);
+		const auto layout = loadLayout(initFilePath);
+		tlb.flushAll();
+		for (const auto& segmentInfo : layout.segments) initSegment(segmentInfo);
+		for (const auto& pageInfo : layout.pages) initPage(pageInfo);
+		if (invertedPageTable) foldPageTables();
     }
 
-	void parseVirtualAddresses(std::filesystem::path vaFilePath)
+	// Translate through one inverted page table instead of a PT frame per segment, for sparse address spaces where most of every PT is
+	// unused: the resident PTs are folded into it and their frames freed, a PT on the disk is folded when its segment is first walked
+	void enableInvertedPageTable()
 	{
-		auto vaFile = std::ifstream{vaFilePath};
+		if (invertedPageTable) return;
+		invertedPageTable = std::make_unique<InvertedPageTable>(frameCount);
+		const auto previousAddressSpace = activeAddressSpace;
+		for (AddressSpaceID addressSpace = 0; addressSpace < segmentTableRoots.size(); addressSpace++)
+		{
+			if (segmentTableRoots[addressSpace] < 0) continue;
+			activeAddressSpace = addressSpace;
+			foldPageTables();
+		}
+		activeAddressSpace = previousAddressSpace;
+		tlb.flushAll(); // Frames of the PTs may be handed out again
+	}
+
+	[[nodiscard]] static AddressSpaceLayout loadLayout(const std::filesystem::path& initFilePath)
+	{
+		auto layout = AddressSpaceLayout{};
+		parseInitFile(initFilePath, [&layout](const SegmentInfo& segmentInfo){ layout.segments.push_back(segmentInfo); }, [&layout](const PageInfo& pageInfo){ layout.pages.push_back(pageInfo); });
+		return layout;
+	}
+
+	// Stream an init file from a private mapping: onSegment(SegmentInfo) for every triple of the first line, then onPage(PageInfo) for every
+	// triple of the second, parsed in place with from_chars so nothing is allocated per token and a large file loads at the speed of its pages
+	// The errors are the ones std::stoul/std::stol used to throw, checked after the number of tokens like when the lines were tokenized first
+	template<typename OnSegment, typename OnPage>
+	static void parseInitFile(const std::filesystem::path& initFilePath, OnSegment onSegment, OnPage onPage)
+	{
+		if (!std::filesystem::is_regular_file(initFilePath)) throw std::runtime_error{"Invalid input file."};
+		if (std::filesystem::file_size(initFilePath) == 0) throw std::runtime_error{"Failed to get input command to initialize a segment table."};
+		const auto initFile = MappedFile::open(initFilePath, 0, MappedFile::Mode::Private);
+		const auto* begin = reinterpret_cast<const char*>(initFile.data());
+		const auto* end = begin + initFile.getSize();
+		const auto* segmentLineEnd = std::find(begin, end, '\n');
+		if (segmentLineEnd == end || segmentLineEnd + 1 == end) throw std::runtime_error{"Failed to get input command to initialize page tables."}; // Checked before applying anything
+		parseInfoLine<SegmentInfo>(begin, segmentLineEnd, onSegment);
+		parseInfoLine<PageInfo>(segmentLineEnd + 1, std::find(segmentLineEnd + 1, end, '\n'), onPage);
+	}
+
+	[[nodiscard]] bool wouldFault(uint32_t virtualAddress) const // True if translating the VA in the active address space has to read the disk
+	{
+		const auto va = translateVirtualAddress(virtualAddress);
+		if (va.pw >= static_cast<uint32_t>(physicalMemory[getSegmentSizeLocation(va.s)]) || isLargeSegment(va.s)) return false;
+		if (isInvertedSegment(va.s)) return findInvertedPageFrame(va.s, va.p) < 0;
+		return physicalMemory[getSegmentFrameLocation(va.s)] < 0 || physicalMemory[getPageFrameLocation(va.s, va.p)] < 0;
+	}
+
+	// Three overlapped stages: a reader thread parses chunks of the file into VA batches, this thread translates them
+	// and a writer thread formats the PAs into a large buffer, so the run is bound by the file I/O
+	void parseVirtualAddresses(std::filesystem::path vaFilePath, uint32_t threadCount = 1)
+	{
+		auto vaFile = std::ifstream{vaFilePath, std::ios::binary};
 		if (!vaFile) throw std::runtime_error{"Invalid input file."};
-		auto outputFile = std::ofstream{vaFilePath.parent_path()/"output.txt"}; // Create an output file
-		auto command = std::string{};
-		while (std::getline(vaFile, command))
+		auto outputFile = std::ofstream{vaFilePath.parent_path()/"output.txt", std::ios::binary}; // Create an output file
+
+		auto vaBatches = BoundedQueue<std::vector<uint32_t>>{pipelineDepth};
+		auto paBatches = BoundedQueue<std::vector<int>>{pipelineDepth};
+		auto readerError = std::exception_ptr{};
+		auto writerError = std::exception_ptr{};
+		auto translatorError = std::exception_ptr{};
+
+		auto reader = std::jthread{[&]
+		{
+			try { readVirtualAddresses(vaFile, vaBatches); }
+			catch (...) { readerError = std::current_exception(); }
+			vaBatches.close(); // End of the input
+		}};
+		auto writer = std::jthread{[&]
+		{
+			try { writePhysicalAddresses(paBatches, outputFile); }
+			catch (...)
+			{
+				writerError = std::current_exception();
+				paBatches.close(); // Stop the translator
+			}
+		}};
+		try
+		{
+			while (auto vas = vaBatches.pop())
+			{
+				auto pas = std::vector<int>(vas->size());
+				if (threadCount > 1) translateConcurrent(vas.value(), pas, threadCount);
+				else translate(vas.value(), pas);
+				if (!paBatches.push(std::move(pas))) break;
+			}
+		}
+		catch (...) { translatorError = std::current_exception(); }
+		vaBatches.close(); // Stop the reader if the translation ended early
+		paBatches.close();
+		reader.join();
+		writer.join();
+		if (profiler) // Also when the run failed, ie: a run that exhausted the frames is the one worth reading
+		{
+			auto profileFile = std::ofstream{vaFilePath.parent_path()/"profile.json"};
+			profiler->writeSummary(profileFile);
+		}
+		for (const auto& error : {readerError, translatorError, writerError})
+		{
+			if (error) std::rethrow_exception(error);
+		}
+	}
+
+	[[nodiscard]] static std::vector<uint32_t> parseVirtualAddressChunk(const char* begin, const char* end) // White space separated VAs
+	{
+		auto vas = std::vector<uint32_t>{};
+		vas.reserve(static_cast<size_t>(end - begin) / 8);
+		auto iter = begin;
+		while (true)
 		{
-			const auto vaStrings = tokenizeCommand(command);
-			for (const auto& vaString : vaStrings)
+			while (iter != end && isSpace(*iter)) iter++;
+			if (iter == end) return vas;
+			const auto isNegative = *iter == '-'; // Same wrap around as std::stoul
+			if (isNegative || *iter == '+') iter++;
+			auto va = uint64_t{0};
+			const auto [next, error] = std::from_chars(iter, end, va);
+			if (error != std::errc{} || (next != end && !isSpace(*next))) throw std::runtime_error{"Invalid virtual address."};
+			vas.push_back(static_cast<uint32_t>(isNegative ? 0 - va : va));
+			iter = next;
+		}
+	}
+
+	void enableProfiling(uint64_t windowSize) // Off by default, the translation path only pays a null check then
+	{
+		profiler = std::make_unique<Profiler>(windowSize, static_cast<uint32_t>(std::ranges::count(freeFrames, uint8_t{true})));
+	}
+
+	void translate(std::span<const uint32_t> vas, std::span<int> pas) // Serial batch, -1 marks an invalid address
+	{
+		assert(vas.size() == pas.size());
+		for (size_t i = 0; i < vas.size(); i++)
+		{
+			const auto va = translateVirtualAddress(vas[i]);
+			const auto pa = getPhysicalAddress(va);
+			pas[i] = pa.has_value() ? static_cast<int>(pa.value()) : -1;
+			if (profiler) profiler->onAccess(va.s, va.p, pa.has_value());
+		}
+	}
+
+	// Same results as translate(), the frames handed out depend on the order of the faults so they are resolved in stream order:
+	// 1. Workers scan disjoint slices against the unmodified state and record the first VA that faults on each segment/page
+	// 2. The recorded faults are merged and resolved serially, earliest VA first, exactly as the serial walk would meet them
+	// 3. Workers walk their slices again, nothing faults anymore so the walk only reads the shared state
+	void translateConcurrent(std::span<const uint32_t> vas, std::span<int> pas, uint32_t threadCount)
+	{
+		assert(vas.size() == pas.size());
+		if (profiler) return translate(vas, pas); // The profiler needs every access in VA order
+		if (invertedPageTable) return translate(vas, pas); // A probe is already short, and the table grows under a fault
+		constexpr size_t minimumSliceSize = 4096; // Below that, spawning threads costs more than the walk
+		threadCount = static_cast<uint32_t>(std::min<size_t>(threadCount, vas.size() / minimumSliceSize));
+		if (threadCount <= 1) return translate(vas, pas);
+
+		const auto sliceSize = (vas.size() + threadCount - 1) / threadCount;
+		const auto forEachSlice = [&](const auto& function)
+		{
+			auto workers = std::vector<std::jthread>{};
+			for (uint32_t thread = 0; thread < threadCount; thread++)
+			{
+				const auto begin = std::min(vas.size(), thread * sliceSize);
+				const auto end = std::min(vas.size(), begin + sliceSize);
+				workers.emplace_back([&function, thread, begin, end]{ function(thread, begin, end); });
+			}
+		}; // Workers join when going out of scope
+
+		auto sliceFaults = std::vector<std::vector<Fault>>(threadCount);
+		forEachSlice([&](uint32_t thread, size_t begin, size_t end)
+		{
+			auto seen = std::unordered_map<uint64_t, size_t>{}; // Fault key -> first VA index within this slice
+			for (size_t i = begin; i < end; i++)
+			{
+				const auto va = translateVirtualAddress(vas[i]);
+				if (va.pw >= static_cast<uint32_t>(physicalMemory[getSegmentSizeLocation(va.s)]) || isLargeSegment(va.s)) continue;
+				const auto segmentFrame = physicalMemory[getSegmentFrameLocation(va.s)];
+				if (segmentFrame < 0) seen.try_emplace(Fault{i, Fault::Kind::Segment, va.s, 0}.getKey(), i);
+				const auto pageFrameLocation = static_cast<size_t>(std::abs(getPageFrameLocation(va.s, va.p)));
+				const auto pageTable = segmentFrame < 0 ? std::span<const int>{disk} : std::span<const int>{physicalMemory}; // A non resident PT is read from its block
+				if (pageFrameLocation < pageTable.size() && pageTable[pageFrameLocation] < 0) seen.try_emplace(Fault{i, Fault::Kind::Page, va.s, va.p}.getKey(), i);
+			}
+			for (const auto& [key, index] : seen) sliceFaults[thread].push_back(Fault::fromKey(key, index));
+		});
+
+		auto faults = std::unordered_map<uint64_t, size_t>{}; // Earliest VA index of each fault across all slices
+		for (const auto& slice : sliceFaults)
+		{
+			for (const auto& fault : slice)
+			{
+				const auto [iter, isInserted] = faults.try_emplace(fault.getKey(), fault.index);
+				if (!isInserted) iter->second = std::min(iter->second, fault.index);
+			}
+		}
+		auto orderedFaults = std::vector<Fault>{};
+		orderedFaults.reserve(faults.size());
+		for (const auto& [key, index] : faults) orderedFaults.push_back(Fault::fromKey(key, index));
+		std::ranges::sort(orderedFaults, {}, [](const Fault& fault){ return std::pair{fault.index, fault.kind}; }); // A segment fault precedes the page fault of the same VA
+		for (const auto& fault : orderedFaults)
+		{
+			if (fault.kind == Fault::Kind::Segment) resolveSegmentFault(fault.segment);
+			else resolvePageFault(fault.segment, fault.page);
+		}
+
+		forEachSlice([&](uint32_t, size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++) pas[i] = walk(translateVirtualAddress(vas[i]));
+		});
+	}
+
+	void initCached(const std::filesystem::path& initFilePath, const std::filesystem::path& cacheDirectory) // Replays of the same init file restore its snapshot instead of running init()
+	{
+		checkDiskIsReplaceable(); // The cache is keyed by the init file only, a snapshot would answer for whatever the image holds
+		const auto hash = hashFile(initFilePath);
+		const auto diskBlocks = static_cast<uint32_t>(disk.size() / frameSize);
+		auto snapshotName = std::array<char, 32>{};
+		std::snprintf(snapshotName.data(), snapshotName.size(), "%016llx-%u.snapshot", static_cast<unsigned long long>(hash), diskBlocks);
+		const auto snapshotPath = cacheDirectory/snapshotName.data();
+		if (std::filesystem::exists(snapshotPath) && getSnapshotInitHash(snapshotPath) == hash)
+		{
+			try
+			{
+				restoreSnapshot(snapshotPath);
+				return;
+			}
+			catch (const std::runtime_error&) {} // Corrupted cache entry, the state is untouched so rebuild it below
+		}
+		init(initFilePath);
+		initHash = hash;
+		std::filesystem::create_directories(cacheDirectory);
+		const auto temporaryPath = std::filesystem::path{snapshotPath}.concat(".tmp");
+		saveSnapshot(temporaryPath);
+		std::filesystem::rename(temporaryPath, snapshotPath); // Concurrent instances never observe a partially written snapshot
+	}
+
+	void saveSnapshot(const std::filesystem::path& snapshotPath) // Header, physical memory, free frames then the disk, all raw
+	{
+		if (invertedPageTable) throw std::runtime_error{"Snapshots only hold hierarchical page tables."};
+		auto& header = *reinterpret_cast<SnapshotHeader*>(memoryImage.data());
+		header = SnapshotHeader{snapshotMagic, snapshotVersion, frameCount, frameSize, static_cast<uint32_t>(disk.size() / frameSize), initHash};
+		auto snapshotFile = std::ofstream{snapshotPath, std::ios::binary | std::ios::trunc};
+		if (!snapshotFile) throw std::runtime_error{"Failed to create the snapshot file."};
+		snapshotFile.write(reinterpret_cast<const char*>(memoryImage.data()), static_cast<std::streamsize>(memoryImage.getSize()));
+		snapshotFile.write(reinterpret_cast<const char*>(disk.data()), static_cast<std::streamsize>(disk.size_bytes()));
+		const auto addressSpaces = static_cast<uint32_t>(segmentTableRoots.size()); // Then the ST root of every address space
+		snapshotFile.write(reinterpret_cast<const char*>(&addressSpaces), sizeof(addressSpaces));
+		snapshotFile.write(reinterpret_cast<const char*>(segmentTableRoots.data()), static_cast<std::streamsize>(addressSpaces * sizeof(int)));
+		if (!snapshotFile) throw std::runtime_error{"Failed to write the snapshot file."};
+	}
+
+	void restoreSnapshot(const std::filesystem::path& snapshotPath) // One copy-on-write mapping, the state is used in place without parsing
+	{
+		checkDiskIsReplaceable();
+		auto snapshot = MappedFile::open(snapshotPath, 0, MappedFile::Mode::Private);
+		if (snapshot.getSize() < snapshotDiskOffset) throw std::runtime_error{"Snapshot is truncated."};
+		const auto header = *reinterpret_cast<const SnapshotHeader*>(snapshot.data());
+		if (header.magic != snapshotMagic) throw std::runtime_error{"Not a snapshot file."};
+		if (header.version != snapshotVersion) throw std::runtime_error{"Unsupported snapshot version."};
+		if (header.frameCount != frameCount || header.frameSize != frameSize) throw std::runtime_error{"Snapshot geometry doesn't match the memory manager."};
+		const auto addressSpacesOffset = snapshotDiskOffset + size_t{header.diskBlocks} * frameSize * sizeof(int);
+		if (snapshot.getSize() < addressSpacesOffset + sizeof(uint32_t)) throw std::runtime_error{"Snapshot is truncated."};
+		const auto addressSpaces = snapshot.view<const uint32_t>(addressSpacesOffset, 1).front();
+		const auto roots = snapshot.view<const int>(addressSpacesOffset + sizeof(uint32_t), addressSpaces);
+		if (addressSpaces == 0 || roots.front() != 0) throw std::runtime_error{"Snapshot address spaces are corrupted."};
+
+		memoryImage = std::move(snapshot);
+		diskImage = MappedFile{}; // The disk of the snapshot replaces any mounted disk image
+		physicalMemory = memoryImage.view<int>(snapshotPhysicalMemoryOffset, frameCount * frameSize);
+		freeFrames = memoryImage.view<uint8_t>(snapshotFreeFramesOffset, frameCount);
+		disk = memoryImage.view<int>(snapshotDiskOffset, size_t{header.diskBlocks} * frameSize);
+		initHash = header.initHash;
+		segmentTableRoots.assign(roots.begin(), roots.end());
+		activeAddressSpace = 0;
+		tlb.flushAll();
+		invertedPageTable.reset(); // Back to the PTs of the snapshot
+	}
+
+	// Move a whole segment into a contiguous run of frames and drop its PT, translation then skips the PT level
+	// Resident pages are copied and their frames freed, pages on the disk are read in. False if no run is large enough
+	bool mapLargeSegment(uint32_t segmentNumber)
+	{
+		const auto segmentSize = physicalMemory[getSegmentSizeLocation(segmentNumber)];
+		if (segmentSize <= 0 || isLargeSegment(segmentNumber)) return false;
+		const auto pageCount = (static_cast<uint32_t>(segmentSize) + frameSize - 1) / frameSize;
+		const auto run = allocateFreeFrameRun(pageCount);
+		if (!run.has_value()) return false;
+
+		const auto segmentFrame = physicalMemory[getSegmentFrameLocation(segmentNumber)];
+		const auto isInverted = isInvertedSegment(segmentNumber);
+		const auto pageTable = isInverted ? std::span<int>{} : getPageTable(segmentFrame);
+		for (uint32_t page = 0; page < pageCount; page++)
+		{
+			const auto pageFrame = isInverted ? findInvertedPageFrame(segmentNumber, page) : pageTable[page];
+			const auto runFrame = run.value() + page;
+			if (pageFrame < 0) readBlock(static_cast<uint32_t>(-pageFrame), runFrame);
+			else
+			{
+				std::copy_n(physicalMemory.begin() + pageFrame * frameSize, frameSize, physicalMemory.begin() + runFrame * frameSize);
+				freeFrames[pageFrame] = true;
+				if (profiler) profiler->onFramesFreed(1);
+			}
+		}
+		if (isInverted) eraseInvertedPages(segmentNumber);
+		else if (segmentFrame >= 0) // The PT itself
+		{
+			freeFrames[segmentFrame] = true;
+			if (profiler) profiler->onFramesFreed(1);
+		}
+		physicalMemory[getSegmentFrameLocation(segmentNumber)] = largeSegmentFlag | static_cast<int>(run.value());
+		tlb.flush(activeAddressSpace); // Pages moved
+		return true;
+	}
+
+	uint32_t mapLargeSegments(uint32_t minimumPages) // Largest segments first, return the number of segments mapped
+	{
+		auto segments = std::vector<std::pair<int, uint32_t>>{}; // {size, segment}
+		for (uint32_t segment = 0; segment < segmentTableFrames * frameSize / 2; segment++)
+		{
+			const auto segmentSize = physicalMemory[getSegmentSizeLocation(segment)];
+			if (segmentSize > 0 && static_cast<uint32_t>(segmentSize) > (minimumPages - 1) * frameSize) segments.push_back({segmentSize, segment});
+		}
+		std::ranges::sort(segments, std::greater{});
+		return static_cast<uint32_t>(std::ranges::count_if(segments, [this](const auto& pair){ return mapLargeSegment(pair.second); }));
+	}
+
+	[[nodiscard]] AddressSpaceID createAddressSpace() // New address space with an empty ST, every segment has size 0 until an init
+	{
+		reserveSegmentTableFrames();
+		const auto root = allocateFreeFrameRun(segmentTableFrames);
+		if (!root.has_value()) throw std::runtime_error{"No free frames left for a segment table."};
+		std::fill_n(physicalMemory.begin() + root.value() * frameSize, segmentTableFrames * frameSize, 0);
+		const auto freeSlot = std::ranges::find(segmentTableRoots, -1);
+		if (freeSlot != segmentTableRoots.end())
+		{
+			*freeSlot = static_cast<int>(root.value());
+			return static_cast<AddressSpaceID>(std::distance(segmentTableRoots.begin(), freeSlot));
+		}
+		segmentTableRoots.push_back(static_cast<int>(root.value()));
+		return static_cast<AddressSpaceID>(segmentTableRoots.size() - 1);
+	}
+
+	// New address space following a layout, with private frames: every PT is made resident in a fresh frame and every resident page of
+	// the layout gets a fresh frame, pages on the disk stay there. The disk is shared so it is never written
+	// A page of a segment the layout doesn't declare is skipped, the new ST has no PT for it (address space 0 writes it through PM[2s + 1])
+	[[nodiscard]] AddressSpaceID createAddressSpace(const AddressSpaceLayout& layout)
+	{
+		const auto addressSpace = createAddressSpace(); // From here on, no allocation can take address space 0's ST
+		const auto previousAddressSpace = activeAddressSpace;
+		activeAddressSpace = addressSpace;
+		auto isDeclared = std::array<bool, segmentTableFrames * frameSize / 2>{};
+		try
+		{
+			for (const auto& segmentInfo : layout.segments)
+			{
+				if (segmentInfo.number >= isDeclared.size()) throw std::runtime_error{"Segment is out of the segment table."};
+				isDeclared[segmentInfo.number] = true;
+				const auto pageTableFrame = allocateFreeFrameLocation();
+				if (segmentInfo.frame < 0) readBlock(static_cast<uint32_t>(-segmentInfo.frame), pageTableFrame);
+				else std::fill_n(physicalMemory.begin() + pageTableFrame * frameSize, frameSize, -1);
+				physicalMemory[getSegmentSizeLocation(segmentInfo.number)] = segmentInfo.size;
+				physicalMemory[getSegmentFrameLocation(segmentInfo.number)] = static_cast<int>(pageTableFrame);
+			}
+			for (const auto& pageInfo : layout.pages)
+			{
+				if (pageInfo.segment >= isDeclared.size() || !isDeclared[pageInfo.segment]) continue;
+				auto pageFrame = pageInfo.frame;
+				if (pageFrame >= 0)
+				{
+					pageFrame = static_cast<int>(allocateFreeFrameLocation());
+					std::fill_n(physicalMemory.begin() + pageFrame * frameSize, frameSize, -1);
+				}
+				physicalMemory[getPageFrameLocation(pageInfo.segment, pageInfo.number)] = pageFrame;
+			}
+			if (invertedPageTable) foldPageTables();
+		}
+		catch (const std::runtime_error&)
+		{
+			activeAddressSpace = previousAddressSpace;
+			destroyAddressSpace(addressSpace); // Give back whatever was allocated
+			throw;
+		}
+		activeAddressSpace = previousAddressSpace;
+		return addressSpace;
+	}
+
+	uint32_t destroyAddressSpace(AddressSpaceID addressSpace) // Free the ST, PTs and pages of the space, return the number of frames freed
+	{
+		if (addressSpace == 0) throw std::runtime_error{"Address space 0 can't be destroyed."};
+		if (addressSpace == activeAddressSpace) throw std::runtime_error{"Can't destroy the active address space."};
+		if (addressSpace >= segmentTableRoots.size() || segmentTableRoots[addressSpace] < 0) throw std::runtime_error{"Invalid address space."};
+
+		const auto root = static_cast<uint32_t>(segmentTableRoots[addressSpace]);
+		auto framesFreed = uint32_t{0};
+		const auto freeFrame = [&](uint32_t frame)
+		{
+			freeFrames[frame] = true;
+			framesFreed++;
+		};
+		for (uint32_t segment = 0; segment < segmentTableFrames * frameSize / 2; segment++)
+		{
+			const auto segmentSize = physicalMemory[root * frameSize + 2 * segment];
+			const auto segmentFrame = physicalMemory[root * frameSize + 2 * segment + 1];
+			if (segmentSize <= 0 || segmentFrame < 0 || segmentFrame == invertedSegmentFlag) continue; // Nothing resident, or its pages are in the inverted page table
+			const auto pageCount = (static_cast<uint32_t>(segmentSize) + frameSize - 1) / frameSize;
+			if ((segmentFrame & largeSegmentFlag) != 0)
+			{
+				for (uint32_t page = 0; page < pageCount; page++) freeFrame((segmentFrame & ~largeSegmentFlag) + page);
+				continue;
+			}
+			for (uint32_t page = 0; page < pageCount; page++)
 			{
-				const auto vaTranslateInfo = translateVirtualAddress(static_cast<uint32_t>(std::stoul(vaString)));
-				const auto pa = getPhysicalAddress(vaTranslateInfo);
-				if (pa.has_value()) outputFile << pa.value() << " ";
-				else outputFile << -1 << " ";
+				const auto pageFrame = physicalMemory[segmentFrame * frameSize + page];
+				if (pageFrame >= 0) freeFrame(pageFrame);
 			}
+			freeFrame(segmentFrame);
 		}
+		if (invertedPageTable)
+		{
+			invertedPageTable->eraseIf([&](uint32_t key, int pageFrame)
+			{
+				if (InvertedPageTable::getAddressSpace(key) != addressSpace) return false;
+				if (pageFrame >= 0) freeFrame(static_cast<uint32_t>(pageFrame));
+				return true;
+			});
+		}
+		for (uint32_t frame = 0; frame < segmentTableFrames; frame++) freeFrame(root + frame);
+		if (profiler) profiler->onFramesFreed(framesFreed);
+		segmentTableRoots[addressSpace] = -1;
+		tlb.flush(addressSpace); // The identifier may be handed out again
+		return framesFreed;
+	}
+
+	void contextSwitch(AddressSpaceID addressSpace) // The TLB is tagged, nothing to flush
+	{
+		if (addressSpace >= segmentTableRoots.size() || segmentTableRoots[addressSpace] < 0) throw std::runtime_error{"Invalid address space."};
+		activeAddressSpace = addressSpace;
+	}
+
+	[[nodiscard]] AddressSpaceID getActiveAddressSpace() const noexcept { return activeAddressSpace; }
+
+	void reset() // Back to a freshly constructed manager so it can be reused (ie: by a pool of sessions), a disk backed by a file is left as is
+	{
+		mountMemory();
+		if (diskImage.getMode() == MappedFile::Mode::Anonymous) std::ranges::fill(disk, -1);
+		initHash = 0;
+		profiler.reset();
+		segmentTableRoots.assign(1, 0);
+		activeAddressSpace = 0;
+		tlb.flushAll();
+		invertedPageTable.reset();
+	}
+
+	void syncDisk() // Persist the disk image, no-op if the disk isn't backed by a shared file
+	{
+		diskImage.sync();
 	}
 
 private:
-	struct SegmentInfo // A segment at 'frame' owns multiples pages. The pages are resided at different frame and may/may not be contiguous to one another
+	struct DiskImageHeader // Leading bytes of a disk image, the blocks follow at diskImageDataOffset
 	{
-		uint32_t number; // Segment number index
-		uint32_t size; // Size of the segment in term of word
-		int frame; // Residing location, positive if on physical memory, negative if on disk
+		std::array<char, 8> magic;
+		uint32_t version;
+		uint32_t blocks;
+		uint32_t blockSize; // Words per block
 	};
-	struct PageInfo
+	static constexpr auto diskImageMagic = std::array<char, 8>{'M', 'M', 'D', 'I', 'S', 'K', '\0', '\0'};
+	static constexpr uint32_t diskImageVersion = 1;
+	static constexpr size_t diskImageDataOffset = 64; // Keep the blocks cache line aligned
+
+	struct SnapshotHeader // Leading bytes of a snapshot, every section starts at a fixed offset so a mapped snapshot is usable as is, the ST roots trail the disk
 	{
-		uint32_t segment; // Owner
-		uint32_t number; // Page number index
-		int frame; // Residing location, positive if on physical memory, negative if on disk
+		std::array<char, 8> magic;
+		uint32_t version;
+		uint32_t frameCount;
+		uint32_t frameSize;
+		uint32_t diskBlocks;
+		uint64_t initHash; // Fingerprint of the init file this state was built from, 0 if unknown
 	};
+	static constexpr auto snapshotMagic = std::array<char, 8>{'M', 'M', 'S', 'N', 'A', 'P', '\0', '\0'};
+	static constexpr uint32_t snapshotVersion = 2;
+	static constexpr size_t snapshotPhysicalMemoryOffset = 64;
+	static constexpr size_t snapshotFreeFramesOffset = snapshotPhysicalMemoryOffset + size_t{frameCount} * frameSize * sizeof(int);
+	static constexpr size_t pipelineChunkSize = size_t{1} << 22; // Bytes read or written at once by the VA pipeline
+	static constexpr size_t pipelineDepth = 4; // Batches in flight between two stages
+
+	static constexpr size_t snapshotDiskOffset = snapshotFreeFramesOffset + (frameCount + 63) / 64 * 64;
+
 	struct TranslateInfo
 	{
 		uint32_t s;
@@ -74,16 +594,31 @@ private:
 		uint32_t pw;
 		uint32_t va; // Original virtual address
 	};
+	struct Fault // A segment or page that has to be brought in from the disk, first needed by the VA at 'index' of a batch
+	{
+		enum class Kind : uint8_t {Segment, Page};
+
+		[[nodiscard]] uint64_t getKey() const noexcept { return (uint64_t{segment} << 10) | (uint64_t{page} << 1) | static_cast<uint64_t>(kind); }
+		[[nodiscard]] static Fault fromKey(uint64_t key, size_t index) noexcept
+		{
+			return Fault{index, static_cast<Kind>(key & 1), static_cast<uint32_t>(key >> 10), static_cast<uint32_t>((key >> 1) & 0x1FF)};
+		}
+
+		size_t index;
+		Kind kind;
+		uint32_t segment;
+		uint32_t page;
+	};
  
-	inline auto getSegmentSizeLocation(uint32_t segmentNumber)
+	inline uint32_t getSegmentSizeLocation(uint32_t segmentNumber) const // Within the ST of the active address space
 	{
-		return 2 * segmentNumber;
+		return static_cast<uint32_t>(segmentTableRoots[activeAddressSpace]) * frameSize + 2 * segmentNumber;
 	}
-	inline auto getSegmentFrameLocation(uint32_t segmentNumber)
+	inline uint32_t getSegmentFrameLocation(uint32_t segmentNumber) const
 	{
-		return 2 * segmentNumber + 1;
+		return static_cast<uint32_t>(segmentTableRoots[activeAddressSpace]) * frameSize + 2 * segmentNumber + 1;
 	}
-	inline auto getPageFrameLocation(uint32_t segmentNumber, uint32_t pageNumber) // The location to a segment's pages within a PT
+	inline int getPageFrameLocation(uint32_t segmentNumber, uint32_t pageNumber) const // The location to a segment's pages within a PT
 	{
 		const auto segmentFrameLocation = physicalMemory[getSegmentFrameLocation(segmentNumber)];
 		return segmentFrameLocation * 512 + (segmentFrameLocation < 0 ? -1 : 1) * static_cast<int>(pageNumber); // Can be negative
@@ -95,69 +630,221 @@ private:
 		return physicalMemory[pageFrameLocation] * 512 + wordOffset; // wordOffset [0, 511], PT of pageNumber occupied locations 
 	}
 
-	inline auto allocateFreeFrameLocation()
+	[[nodiscard]] std::optional<uint32_t> allocateFreeFrameRun(uint32_t count) // First fit, never inside the ST
 	{
-		const auto frameIter = std::ranges::find(freeFrames, true);
-		assert(frameIter != freeFrames.end()); // Failed assumption
-		*frameIter = false;
-		return std::distance(freeFrames.begin(), frameIter);
+		const auto candidates = freeFrames.subspan(segmentTableFrames);
+		const auto run = std::ranges::search_n(candidates, count, uint8_t{true});
+		if (run.empty()) return std::nullopt;
+		std::ranges::fill(run, uint8_t{false});
+		if (profiler) profiler->onFramesAllocated(count);
+		return static_cast<uint32_t>(std::distance(freeFrames.begin(), run.begin()));
 	}
 
-	void initPhysicalMemory(const std::vector<SegmentInfo>& segmentInfos, const std::vector<PageInfo>& pageInfos)
+	// The init file never marks the frames of address space 0's ST as taken, so a fault could hand them out. Harmless to the baseline with
+	// one address space, but a fault in another space would overwrite that ST: from the second address space on they are never free
+	void reserveSegmentTableFrames()
 	{
-		for (const auto& segmentInfo : segmentInfos)
+		const auto segmentTable = freeFrames.first(segmentTableFrames);
+		const auto freeCount = static_cast<uint32_t>(std::ranges::count(segmentTable, uint8_t{true}));
+		std::ranges::fill(segmentTable, uint8_t{false});
+		if (profiler && freeCount > 0) profiler->onFramesAllocated(freeCount);
+	}
+
+	inline bool isLargeSegment(uint32_t segmentNumber) const
+	{
+		const auto segmentFrame = physicalMemory[getSegmentFrameLocation(segmentNumber)];
+		return segmentFrame >= 0 && (segmentFrame & largeSegmentFlag) != 0;
+	}
+
+	inline bool isInvertedSegment(uint32_t segmentNumber) const
+	{
+		return invertedPageTable && physicalMemory[getSegmentFrameLocation(segmentNumber)] == invertedSegmentFlag;
+	}
+
+	inline int getLargeSegmentAddress(const TranslateInfo& va) const // PA = (PM[2s + 1] without the flag) * 512 + pw
+	{
+		return (physicalMemory[getSegmentFrameLocation(va.s)] & ~largeSegmentFlag) * static_cast<int>(frameSize) + static_cast<int>(va.pw);
+	}
+
+	inline uint32_t allocateFreeFrameLocation()
+	{
+		const auto frameIter = std::ranges::find(freeFrames, uint8_t{true});
+		if (frameIter == freeFrames.end())
 		{
-			physicalMemory[getSegmentSizeLocation(segmentInfo.number)] = segmentInfo.size; // PM[2s] = segmentSize
-			physicalMemory[getSegmentFrameLocation(segmentInfo.number)] = segmentInfo.frame; // PM[2s + 1] = segmentFrame
-			if (segmentInfo.frame >= 0) freeFrames[segmentInfo.frame] = false;
+			if (profiler) profiler->onFramesExhausted();
+			throw std::runtime_error{"No free frame left."}; // Failed assumption
 		}
-		for (const auto& pageInfo : pageInfos)
+		*frameIter = false;
+		if (profiler) profiler->onFramesAllocated(1);
+		return static_cast<uint32_t>(std::distance(freeFrames.begin(), frameIter));
+	}
+
+	void initSegment(const SegmentInfo& segmentInfo) // Every segment is applied before the first page
+	{
+		if (isInvertedSegment(segmentInfo.number)) eraseInvertedPages(segmentInfo.number); // Replaced by the new PT, folded again after the init
+		physicalMemory[getSegmentSizeLocation(segmentInfo.number)] = segmentInfo.size; // PM[2s] = segmentSize
+		physicalMemory[getSegmentFrameLocation(segmentInfo.number)] = segmentInfo.frame; // PM[2s + 1] = segmentFrame
+		if (segmentInfo.frame >= 0) freeFrames[segmentInfo.frame] = false;
+	}
+
+	void initPage(const PageInfo& pageInfo)
+	{
+		if (isInvertedSegment(pageInfo.segment)) invertedPageTable->insertOrAssign(InvertedPageTable::makeKey(activeAddressSpace, pageInfo.segment, pageInfo.number), pageInfo.frame);
+		else
 		{
 			const auto pageFrameLocation = getPageFrameLocation(pageInfo.segment, pageInfo.number); // PT
-			if (pageFrameLocation < 0) disk[std::abs(pageFrameLocation) / 512][std::abs(pageFrameLocation) % 512] = pageInfo.frame;
+			if (pageFrameLocation < 0)
+			{
+				if (static_cast<size_t>(std::abs(pageFrameLocation)) >= disk.size()) throw std::runtime_error{"Page table block is out of the disk."};
+				disk[std::abs(pageFrameLocation)] = pageInfo.frame; // Block |PM[2s + 1]|, word p
+			}
 			else physicalMemory[pageFrameLocation] = pageInfo.frame;
-
-			freeFrames[pageInfo.number] = false;
-			if (pageInfo.frame >= 0) freeFrames[pageInfo.frame] = false;
 		}
+
+		freeFrames[pageInfo.number] = false;
+		if (pageInfo.frame >= 0) freeFrames[pageInfo.frame] = false;
 	}
 
 	std::optional<uint32_t> getPhysicalAddress(const TranslateInfo& va)
 	{
-		if (va.pw >= physicalMemory[getSegmentSizeLocation(va.s)]) return std::nullopt;
+		const auto* cached = tlb.lookup(activeAddressSpace, va.s, va.p);
+		if (profiler) profiler->onTlbLookup(cached != nullptr);
+		if (cached != nullptr)
+		{
+			if (va.pw >= static_cast<uint32_t>(cached->segmentSize)) return std::nullopt;
+			return static_cast<uint32_t>(cached->frame) * frameSize + va.w;
+		}
 
-		// Only frames/pages are either valid (uint32_t) or not valid (negative int)
-		if (physicalMemory[getSegmentFrameLocation(va.s)] < 0)
+		const auto segmentSize = physicalMemory[getSegmentSizeLocation(va.s)];
+		if (va.pw >= static_cast<uint32_t>(segmentSize)) return std::nullopt;
+		if (isLargeSegment(va.s))
 		{
-			const auto segmentBlock = std::abs(physicalMemory[getSegmentFrameLocation(va.s)]);
-			const auto freeFrameLocation = allocateFreeFrameLocation();
-			readBlock(segmentBlock, freeFrameLocation);
-			physicalMemory[getSegmentFrameLocation(va.s)] = freeFrameLocation;
-			//Allocate free frame f1 using list of free frames
-			//Update list of free frames
-			//Read disk block b = |PM[2s + 1]| into PM staring at location f1*512
-			//PM[2s + 1] = f1
+			const auto pa = static_cast<uint32_t>(getLargeSegmentAddress(va));
+			tlb.insert(activeAddressSpace, va.s, va.p, static_cast<int>(pa / frameSize), segmentSize);
+			return pa;
 		}
-		//const auto pageFrame = std::get_if<uint32_t>(&physicalMemory[physicalMemory[2ull * va.s + 1ull] * 512ull + va.p]);
-		if (physicalMemory[getPageFrameLocation(va.s, va.p)] < 0)
+
+		if (invertedPageTable)
 		{
-			const auto pageBlock = std::abs(physicalMemory[getPageFrameLocation(va.s, va.p)]);
-			const auto freeFrameLocation = allocateFreeFrameLocation();
-			readBlock(pageBlock, freeFrameLocation);
-			physicalMemory[getPageFrameLocation(va.s, va.p)] = freeFrameLocation;
-			//Allocate free frame f2 using list of free frames
-			//Update list of free frames
-			//Read disk block b = |PM[PM[2s + 1]*512 + p]| into PM staring at f2*512
-			//PM[PM[2s + 1]*512 + p] = f2
+			const auto pa = getInvertedPhysicalAddress(va);
+			tlb.insert(activeAddressSpace, va.s, va.p, static_cast<int>(pa / frameSize), segmentSize);
+			return pa;
 		}
-		return static_cast<uint32_t>(getWordLocation(va.s, va.p, va.w));
+
+		// Only frames/pages are either valid (uint32_t) or not valid (negative int)
+		if (physicalMemory[getSegmentFrameLocation(va.s)] < 0) resolveSegmentFault(va.s);
+		//const auto pageFrame = std::get_if<uint32_t>(&physicalMemory[physicalMemory[2ull * va.s + 1ull] * 512ull + va.p]);
+		if (physicalMemory[getPageFrameLocation(va.s, va.p)] < 0) resolvePageFault(va.s, va.p);
+		const auto pa = static_cast<uint32_t>(getWordLocation(va.s, va.p, va.w));
+		tlb.insert(activeAddressSpace, va.s, va.p, static_cast<int>(pa / frameSize), segmentSize);
+		return pa;
 
 		// PA = PM[PM[2s+1]*512+p]*512+w, check for page fault
 		// s: 9 bit, p: 9 bit, w:; 9 bit, present bit: 1 bit
 		// The sign bit is used as the present bit (negative = not resident
 	}
 
-	TranslateInfo translateVirtualAddress(uint32_t va)
+	void resolveSegmentFault(uint32_t segmentNumber)
+	{
+		if (profiler) profiler->onSegmentFault();
+		const auto segmentBlock = std::abs(physicalMemory[getSegmentFrameLocation(segmentNumber)]);
+		const auto freeFrameLocation = allocateFreeFrameLocation();
+		readBlock(segmentBlock, freeFrameLocation);
+		physicalMemory[getSegmentFrameLocation(segmentNumber)] = static_cast<int>(freeFrameLocation);
+		//Allocate free frame f1 using list of free frames
+		//Update list of free frames
+		//Read disk block b = |PM[2s + 1]| into PM staring at location f1*512
+		//PM[2s + 1] = f1
+	}
+
+	void resolvePageFault(uint32_t segmentNumber, uint32_t pageNumber) // The segment's PT must be resident
+	{
+		if (profiler) profiler->onPageFault();
+		const auto pageBlock = std::abs(physicalMemory[getPageFrameLocation(segmentNumber, pageNumber)]);
+		const auto freeFrameLocation = allocateFreeFrameLocation();
+		readBlock(pageBlock, freeFrameLocation);
+		physicalMemory[getPageFrameLocation(segmentNumber, pageNumber)] = static_cast<int>(freeFrameLocation);
+		//Allocate free frame f2 using list of free frames
+		//Update list of free frames
+		//Read disk block b = |PM[PM[2s + 1]*512 + p]| into PM staring at f2*512
+		//PM[PM[2s + 1]*512 + p] = f2
+	}
+
+	uint32_t getInvertedPhysicalAddress(const TranslateInfo& va) // One probe of the inverted page table, a page on the disk is read in like resolvePageFault
+	{
+		if (!isInvertedSegment(va.s))
+		{
+			if (profiler && physicalMemory[getSegmentFrameLocation(va.s)] < 0) profiler->onSegmentFault(); // Its PT is read from the disk
+			foldPageTable(va.s);
+		}
+		auto pageFrame = findInvertedPageFrame(va.s, va.p);
+		if (pageFrame < 0)
+		{
+			if (profiler) profiler->onPageFault();
+			const auto freeFrameLocation = allocateFreeFrameLocation();
+			readBlock(static_cast<uint32_t>(std::abs(pageFrame)), freeFrameLocation);
+			pageFrame = static_cast<int>(freeFrameLocation);
+			invertedPageTable->insertOrAssign(InvertedPageTable::makeKey(activeAddressSpace, va.s, va.p), pageFrame);
+		}
+		return static_cast<uint32_t>(pageFrame) * frameSize + va.w;
+	}
+
+	[[nodiscard]] int findInvertedPageFrame(uint32_t segmentNumber, uint32_t pageNumber) const // In the active address space
+	{
+		const auto* pageFrame = invertedPageTable->find(InvertedPageTable::makeKey(activeAddressSpace, segmentNumber, pageNumber));
+		return pageFrame != nullptr ? *pageFrame : -1; // Never mapped reads like a PT word still holding -1
+	}
+
+	[[nodiscard]] std::span<int> getPageTable(int segmentFrame) // A PT either in its frame or in its disk block
+	{
+		if (segmentFrame >= 0) return physicalMemory.subspan(static_cast<size_t>(segmentFrame) * frameSize, frameSize);
+		const auto block = static_cast<size_t>(std::abs(segmentFrame));
+		if ((block + 1) * frameSize > disk.size()) throw std::runtime_error{"Block is out of the disk."};
+		return disk.subspan(block * frameSize, frameSize);
+	}
+
+	void foldPageTable(uint32_t segmentNumber) // Move the PT of a segment of the active address space into the inverted page table, freeing its frame
+	{
+		const auto segmentSize = physicalMemory[getSegmentSizeLocation(segmentNumber)];
+		const auto segmentFrame = physicalMemory[getSegmentFrameLocation(segmentNumber)];
+		const auto pageTable = getPageTable(segmentFrame);
+		const auto pageCount = (static_cast<uint32_t>(segmentSize) + frameSize - 1) / frameSize;
+		for (uint32_t page = 0; page < pageCount; page++)
+		{
+			if (pageTable[page] != -1) invertedPageTable->insertOrAssign(InvertedPageTable::makeKey(activeAddressSpace, segmentNumber, page), pageTable[page]);
+		}
+		if (segmentFrame >= 0)
+		{
+			freeFrames[segmentFrame] = true;
+			if (profiler) profiler->onFramesFreed(1);
+		}
+		physicalMemory[getSegmentFrameLocation(segmentNumber)] = invertedSegmentFlag;
+	}
+
+	void foldPageTables() // Every resident PT of the active address space, the PTs on the disk wait for their first walk
+	{
+		for (uint32_t segment = 0; segment < segmentTableFrames * frameSize / 2; segment++)
+		{
+			const auto segmentFrame = physicalMemory[getSegmentFrameLocation(segment)];
+			if (physicalMemory[getSegmentSizeLocation(segment)] > 0 && segmentFrame >= 0 && segmentFrame != invertedSegmentFlag && !isLargeSegment(segment)) foldPageTable(segment);
+		}
+	}
+
+	void eraseInvertedPages(uint32_t segmentNumber) // Mappings of a segment of the active address space, the frames are left to the caller
+	{
+		invertedPageTable->eraseIf([&](uint32_t key, int){ return InvertedPageTable::getAddressSpace(key) == activeAddressSpace && InvertedPageTable::getSegment(key) == segmentNumber; });
+	}
+
+	[[nodiscard]] int walk(const TranslateInfo& va) const // Translation without fault handling, everything it touches must be resident
+	{
+		if (va.pw >= static_cast<uint32_t>(physicalMemory[getSegmentSizeLocation(va.s)])) return -1;
+		if (isLargeSegment(va.s)) return getLargeSegmentAddress(va);
+		const auto pageFrameLocation = getPageFrameLocation(va.s, va.p);
+		assert(pageFrameLocation > 0 && physicalMemory[pageFrameLocation] >= 0);
+		return physicalMemory[pageFrameLocation] * 512 + static_cast<int>(va.w);
+	}
+
+	TranslateInfo translateVirtualAddress(uint32_t va) const
 	{
 		// 32 bits = (5 empty bits) (9 bits = s) (9 bits = p) (9 bits = w)
 		return TranslateInfo{
@@ -171,44 +858,169 @@ private:
 
 	void readBlock(uint32_t b, uint32_t m) // Copy block b from disk to a frame at address m into the physical memory
 	{
-		for (int i = 0; i < disk[b].size(); i++)
+		if ((size_t{b} + 1) * frameSize > disk.size()) throw std::runtime_error{"Block is out of the disk."};
+		std::copy_n(disk.begin() + b * frameSize, frameSize, physicalMemory.begin() + m * frameSize);
+	}
+
+	void mountMemory() // Fresh physical memory and free frames over the memory image
+	{
+		physicalMemory = memoryImage.view<int>(snapshotPhysicalMemoryOffset, frameCount * frameSize);
+		freeFrames = memoryImage.view<uint8_t>(snapshotFreeFramesOffset, frameCount);
+		std::ranges::fill(physicalMemory, -1);
+		std::ranges::fill(freeFrames, uint8_t{true}); // Keep track of the free frames in the physical memory, assuming that a free frame is always available
+	}
+
+	void checkDiskIsReplaceable() const // A snapshot brings its own disk, it can't silently drop an image the user mounted
+	{
+		if (diskImage.getMode() != MappedFile::Mode::Anonymous) throw std::runtime_error{"Snapshots can't be combined with a disk image."};
+	}
+
+	[[nodiscard]] static uint64_t getSnapshotInitHash(const std::filesystem::path& snapshotPath)
+	{
+		auto header = SnapshotHeader{};
+		auto snapshotFile = std::ifstream{snapshotPath, std::ios::binary};
+		if (!snapshotFile.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != snapshotMagic) return 0;
+		return header.initHash;
+	}
+
+	[[nodiscard]] static uint64_t hashFile(const std::filesystem::path& filePath) // FNV-1a over the raw bytes
+	{
+		auto file = std::ifstream{filePath, std::ios::binary};
+		if (!file) throw std::runtime_error{"Invalid input file."};
+		auto hash = uint64_t{14695981039346656037ull};
+		for (auto iter = std::istreambuf_iterator<char>{file}; iter != std::istreambuf_iterator<char>{}; iter++)
+		{
+			hash = (hash ^ static_cast<uint8_t>(*iter)) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static void readVirtualAddresses(std::istream& vaFile, BoundedQueue<std::vector<uint32_t>>& vaBatches)
+	{
+		auto chunk = std::vector<char>(pipelineChunkSize);
+		auto carry = size_t{0}; // Head of a VA cut by the end of the previous chunk
+		while (true)
+		{
+			vaFile.read(chunk.data() + carry, static_cast<std::streamsize>(chunk.size() - carry));
+			const auto readSize = carry + static_cast<size_t>(vaFile.gcount());
+			const auto isLastChunk = readSize < chunk.size();
+			auto parseSize = readSize;
+			if (!isLastChunk)
+			{
+				while (parseSize > 0 && !isSpace(chunk[parseSize - 1])) parseSize--;
+				if (parseSize == 0) throw std::runtime_error{"Virtual address is too long."};
+			}
+			auto vas = parseVirtualAddressChunk(chunk.data(), chunk.data() + parseSize);
+			if (!vas.empty() && !vaBatches.push(std::move(vas))) return;
+			if (isLastChunk) return;
+			carry = readSize - parseSize;
+			std::copy_n(chunk.begin() + parseSize, carry, chunk.begin());
+		}
+	}
+
+	static void writePhysicalAddresses(BoundedQueue<std::vector<int>>& paBatches, std::ostream& outputFile)
+	{
+		constexpr size_t maxFormattedSize = 12; // "-2147483648 "
+		auto buffer = std::vector<char>(pipelineChunkSize);
+		auto used = size_t{0};
+		while (auto pas = paBatches.pop())
 		{
-			physicalMemory[m * 512 + i] = disk[b][i];
+			for (const auto pa : pas.value())
+			{
+				if (used + maxFormattedSize > buffer.size())
+				{
+					outputFile.write(buffer.data(), static_cast<std::streamsize>(used));
+					used = 0;
+				}
+				const auto [next, error] = std::to_chars(buffer.data() + used, buffer.data() + buffer.size(), pa);
+				*next = ' ';
+				used = static_cast<size_t>(next - buffer.data()) + 1;
+			}
 		}
+		outputFile.write(buffer.data(), static_cast<std::streamsize>(used));
+		if (!outputFile) throw std::runtime_error{"Failed to write the output file."};
+	}
+
+	[[nodiscard]] static constexpr bool isSpace(char character) noexcept
+	{
+		return character == ' ' || character == '\n' || character == '\r' || character == '\t' || character == '\v' || character == '\f';
+	}
+
+	static size_t getDiskImageSize(uint32_t diskBlocks)
+	{
+		return diskImageDataOffset + size_t{diskBlocks} * frameSize * sizeof(int);
+	}
+
+	// An image with a header is mapped at its own size, whatever diskBlocks is, so the header decides the geometry. Anything else is
+	// mapped at the size of diskBlocks, a shared image is created or grown to it and formatted by mountDisk()
+	[[nodiscard]] static MappedFile openDiskImage(const std::filesystem::path& diskImagePath, MappedFile::Mode mode, std::optional<uint32_t> diskBlocks)
+	{
+		auto header = DiskImageHeader{};
+		auto imageFile = std::ifstream{diskImagePath, std::ios::binary};
+		const auto isFormatted = imageFile.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.magic == diskImageMagic;
+		imageFile.close();
+		if (isFormatted && diskBlocks.has_value() && diskBlocks.value() != header.blocks) throw std::runtime_error{"Disk image has a different number of blocks."};
+		if (isFormatted || mode == MappedFile::Mode::Private) return MappedFile::open(diskImagePath, 0, mode);
+		return MappedFile::open(diskImagePath, getDiskImageSize(diskBlocks.value_or(defaultDiskBlocks)), mode);
 	}
 
-	[[nodiscard]] std::vector<std::string> tokenizeCommand(std::string_view command)
+	void mountDisk(uint32_t diskBlocks) // Validate or format the image header, then expose the blocks as one flat array of words
 	{
-		auto commandStream = std::istringstream{command.data()};
-		auto tokens = std::vector<std::string>{};
-		auto token = std::string{};
-		while (commandStream >> token)
+		if (diskImage.getSize() < sizeof(DiskImageHeader)) throw std::runtime_error{"Disk image is not formatted."};
+		auto& header = *reinterpret_cast<DiskImageHeader*>(diskImage.data());
+		if (header.magic == diskImageMagic)
 		{
-			tokens.push_back(token);
+			if (header.version != diskImageVersion) throw std::runtime_error{"Unsupported disk image version."};
+			if (header.blockSize != frameSize) throw std::runtime_error{"Disk image block size doesn't match the frame size."};
+			if (getDiskImageSize(header.blocks) > diskImage.getSize()) throw std::runtime_error{"Disk image is truncated."};
+			disk = diskImage.view<int>(diskImageDataOffset, size_t{header.blocks} * frameSize); // An existing image keeps its own geometry
+			return;
 		}
-		return tokens;
+		if (diskImage.getSize() < getDiskImageSize(diskBlocks)) throw std::runtime_error{"Disk image is not formatted."};
+		header = DiskImageHeader{diskImageMagic, diskImageVersion, diskBlocks, frameSize}; // Fresh image (a private mapping formats its own copy only)
+		disk = diskImage.view<int>(diskImageDataOffset, size_t{diskBlocks} * frameSize);
+		std::ranges::fill(disk, -1);
 	}
 
-	template<typename Info>
-	[[nodiscard]] std::vector<Info> toInfos(const std::vector<std::string>& tokenizedCommand)
+	template<typename Info, typename Apply>
+	static void parseInfoLine(const char* iter, const char* end, Apply& apply) // White space separated triples, handed over as soon as they are complete
 	{
-		if (tokenizedCommand.size() % 3 != 0) throw std::runtime_error{"Input command doesn't follow the required format."};
-		auto infos = std::vector<Info>(tokenizedCommand.size() / 3);
-		for (size_t i = 0; i < infos.size(); i++)
+		auto fields = std::array<int64_t, 3>{};
+		auto fieldCount = size_t{0};
+		auto invalidNumber = std::exception_ptr{}; // The first one, thrown once the line is known to be made of triples
+		while (true)
 		{
-			const auto residingFrame = std::stol(tokenizedCommand[i * 3 + 2].data());
-			infos[i] = Info{
-				static_cast<uint32_t>(std::stoul(tokenizedCommand[i * 3].data()))
-				, static_cast<uint32_t>(std::stoul(tokenizedCommand[i * 3 + 1].data()))
-				, static_cast<int>(residingFrame)
-			};
+			while (iter != end && isSpace(*iter)) iter++;
+			if (iter == end) break;
+			const auto* tokenEnd = std::find_if(iter, end, isSpace);
+			const auto isNegative = *iter == '-'; // Same wrap around as std::stoul/std::stol
+			if (isNegative || *iter == '+') iter++;
+			auto value = uint64_t{0};
+			const auto error = std::from_chars(iter, tokenEnd, value).ec; // Like std::stoul, what follows the number in the token is ignored
+			const auto* function = fieldCount == 2 ? "stol" : "stoul";
+			if (error == std::errc::invalid_argument && !invalidNumber) invalidNumber = std::make_exception_ptr(std::invalid_argument{function});
+			if (error == std::errc::result_out_of_range && !invalidNumber) invalidNumber = std::make_exception_ptr(std::out_of_range{function});
+			fields[fieldCount++] = static_cast<int64_t>(isNegative ? 0 - value : value);
+			iter = tokenEnd;
+			if (fieldCount < fields.size()) continue;
+			if (!invalidNumber) apply(Info{static_cast<uint32_t>(fields[0]), static_cast<uint32_t>(fields[1]), static_cast<int>(fields[2])});
+			fieldCount = 0;
 		}
-		return infos;
+		if (fieldCount != 0) throw std::runtime_error{"Input command doesn't follow the required format."};
+		if (invalidNumber) std::rethrow_exception(invalidNumber);
 	}
 
-	std::vector<int> physicalMemory; // Use a lot of stack memory, using the heap instead
-	std::vector<std::vector<int>> disk; // Use a lot of stack memory, using the heap instead
-	std::vector<bool> freeFrames;
+	MappedFile memoryImage; // Owns the storage of the physical memory and the free frames
+	std::span<int> physicalMemory;
+	MappedFile diskImage; // Owns the storage of the disk
+	std::span<int> disk; // Block b occupies disk[b * 512, (b + 1) * 512)
+	std::span<uint8_t> freeFrames; // Bytes rather than vector<bool> so they can be mapped straight from a snapshot
+	uint64_t initHash;
+	std::unique_ptr<Profiler> profiler; // Null unless profiling is enabled
+	std::vector<int> segmentTableRoots; // ST frame of each address space, -1 once destroyed
+	AddressSpaceID activeAddressSpace;
+	Tlb tlb;
+	std::unique_ptr<InvertedPageTable> invertedPageTable; // Null unless enabled, the PTs are walked then
 };
 
 
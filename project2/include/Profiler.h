@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Fault and access-pattern statistics of a MemoryManager run, fed by the translation path in VA order
+// Pages are keyed by (segment << 9) | page
+class Profiler
+{
+public:
+	Profiler(uint64_t inWindowSize, uint32_t inFreeFrames) :
+		windowSize{inWindowSize}
+		, accesses{0}
+		, invalidAccesses{0}
+		, segmentFaults{0}
+		, pageFaults{0}
+		, exhaustions{0}
+		, tlbHits{0}
+		, tlbMisses{0}
+		, freeFrames{inFreeFrames}
+		, minimumFreeFrames{inFreeFrames}
+		, reuseHistogram{}
+		, coldAccesses{0}
+		, lastAccess{}
+		, liveAccesses(1024, 0)
+		, clock{0}
+		, window{}
+		, workingSetSizes{}
+		, segmentAccesses{}
+		, pageAccesses{}
+	{}
+
+	void onAccess(uint32_t segment, uint32_t page, bool isValid)
+	{
+		accesses++;
+		if (isValid)
+		{
+			const auto key = (segment << 9) | page;
+			segmentAccesses[segment]++;
+			pageAccesses[key]++;
+			recordReuse(key);
+			window.insert(key);
+		}
+		else invalidAccesses++;
+		if (accesses % windowSize == 0)
+		{
+			workingSetSizes.push_back(window.size());
+			window.clear();
+		}
+	}
+
+	void onSegmentFault() { segmentFaults++; }
+	void onPageFault() { pageFaults++; }
+	void onFramesExhausted() { exhaustions++; }
+	void onTlbLookup(bool isHit) { (isHit ? tlbHits : tlbMisses)++; }
+
+	void onFramesAllocated(uint32_t count)
+	{
+		freeFrames -= count;
+		minimumFreeFrames = std::min(minimumFreeFrames, freeFrames);
+	}
+
+	void onFramesFreed(uint32_t count) { freeFrames += count; }
+
+	void writeSummary(std::ostream& output) const // JSON
+	{
+		constexpr size_t hottestCount = 10;
+		output << "{\n";
+		output << "\t\"accesses\": " << accesses << ",\n";
+		output << "\t\"invalidAccesses\": " << invalidAccesses << ",\n";
+		output << "\t\"segmentFaults\": " << segmentFaults << ",\n";
+		output << "\t\"pageFaults\": " << pageFaults << ",\n";
+		output << "\t\"tlb\": {\"hits\": " << tlbHits << ", \"misses\": " << tlbMisses << "},\n";
+		output << "\t\"freeFrames\": {\"remaining\": " << freeFrames << ", \"minimum\": " << minimumFreeFrames << ", \"exhaustions\": " << exhaustions << "},\n";
+
+		output << "\t\"reuseDistance\": {\"cold\": " << coldAccesses << ", \"buckets\": ["; // Bucket 0: distance 0, bucket i: [2^(i - 1), 2^i)
+		const auto lastBucket = std::distance(reuseHistogram.begin(), std::ranges::find_if(reuseHistogram.rbegin(), reuseHistogram.rend(), [](uint64_t count){ return count != 0; }).base());
+		for (ptrdiff_t bucket = 0; bucket < lastBucket; bucket++) output << (bucket == 0 ? "" : ", ") << reuseHistogram[bucket];
+		output << "]},\n";
+
+		output << "\t\"workingSet\": {\"window\": " << windowSize << ", \"sizes\": [";
+		for (size_t i = 0; i < workingSetSizes.size(); i++) output << (i == 0 ? "" : ", ") << workingSetSizes[i];
+		if (!window.empty()) output << (workingSetSizes.empty() ? "" : ", ") << window.size(); // Partial last window
+		output << "]},\n";
+
+		output << "\t\"hottestSegments\": [";
+		const auto hottestSegments = getHottest(segmentAccesses, hottestCount);
+		for (size_t i = 0; i < hottestSegments.size(); i++)
+		{
+			output << (i == 0 ? "" : ", ") << "{\"segment\": " << hottestSegments[i].first << ", \"accesses\": " << hottestSegments[i].second << "}";
+		}
+		output << "],\n";
+
+		output << "\t\"hottestPages\": [";
+		const auto hottestPages = getHottest(pageAccesses, hottestCount);
+		for (size_t i = 0; i < hottestPages.size(); i++)
+		{
+			const auto [key, count] = hottestPages[i];
+			output << (i == 0 ? "" : ", ") << "{\"segment\": " << (key >> 9) << ", \"page\": " << (key & 0x1FF) << ", \"accesses\": " << count << "}";
+		}
+		output << "]\n";
+		output << "}\n";
+	}
+
+private:
+	// Reuse distance = distinct pages touched since the previous access of the same page
+	// liveAccesses is a Fenwick tree over access times with a 1 at the latest access of every page
+	void recordReuse(uint32_t key)
+	{
+		if (clock == liveAccesses.size()) compactClock();
+		const auto [iter, isCold] = lastAccess.try_emplace(key, clock);
+		if (isCold) coldAccesses++;
+		else
+		{
+			const auto previous = iter->second;
+			const auto distance = countLive(clock) - countLive(previous + 1);
+			reuseHistogram[std::bit_width(distance)]++;
+			updateLive(previous, -1);
+			iter->second = clock;
+		}
+		updateLive(clock, 1);
+		clock++;
+	}
+
+	void compactClock() // Renumber the latest accesses 0..K-1 and keep twice as many slots free
+	{
+		auto latest = std::vector<std::pair<uint64_t, uint32_t>>{}; // {time, key}
+		latest.reserve(lastAccess.size());
+		for (const auto& [key, time] : lastAccess) latest.push_back({time, key});
+		std::ranges::sort(latest);
+		liveAccesses.assign(std::max<size_t>(1024, latest.size() * 2), 0);
+		clock = 0;
+		for (const auto& [time, key] : latest)
+		{
+			lastAccess[key] = clock;
+			updateLive(clock++, 1);
+		}
+	}
+
+	void updateLive(uint64_t time, int64_t delta)
+	{
+		for (auto i = time + 1; i <= liveAccesses.size(); i += i & (~i + 1)) liveAccesses[i - 1] += delta;
+	}
+
+	[[nodiscard]] uint64_t countLive(uint64_t end) const // Live accesses within [0, end)
+	{
+		auto count = int64_t{0};
+		for (auto i = end; i > 0; i -= i & (~i + 1)) count += liveAccesses[i - 1];
+		return static_cast<uint64_t>(count);
+	}
+
+	[[nodiscard]] static std::vector<std::pair<uint32_t, uint64_t>> getHottest(const std::unordered_map<uint32_t, uint64_t>& counts, size_t count)
+	{
+		auto hottest = std::vector<std::pair<uint32_t, uint64_t>>(counts.begin(), counts.end());
+		const auto byAccesses = [](const auto& left, const auto& right){ return std::pair{left.second, right.first} > std::pair{right.second, left.first}; };
+		const auto middle = hottest.begin() + static_cast<ptrdiff_t>(std::min(count, hottest.size()));
+		std::partial_sort(hottest.begin(), middle, hottest.end(), byAccesses);
+		hottest.erase(middle, hottest.end());
+		return hottest;
+	}
+
+	uint64_t windowSize; // Accesses per working set sample
+	uint64_t accesses;
+	uint64_t invalidAccesses;
+	uint64_t segmentFaults;
+	uint64_t pageFaults;
+	uint64_t exhaustions; // Faults that found no free frame
+	uint64_t tlbHits;
+	uint64_t tlbMisses;
+	uint32_t freeFrames;
+	uint32_t minimumFreeFrames;
+
+	std::array<uint64_t, 65> reuseHistogram;
+	uint64_t coldAccesses; // First access of a page, no reuse distance
+	std::unordered_map<uint32_t, uint64_t> lastAccess; // Page -> time of its latest access
+	std::vector<int64_t> liveAccesses;
+	uint64_t clock;
+
+	std::unordered_set<uint32_t> window; // Distinct pages of the current working set window
+	std::vector<size_t> workingSetSizes;
+
+	std::unordered_map<uint32_t, uint64_t> segmentAccesses;
+	std::unordered_map<uint32_t, uint64_t> pageAccesses;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Direct mapped translation cache, every entry is tagged with its address space so a context switch doesn't need a flush
+class Tlb
+{
+public:
+	struct Entry
+	{
+		uint32_t addressSpace;
+		uint32_t page; // (segment << 9) | page
+		int frame;
+		int segmentSize; // Kept for the bound check of hits
+		bool isValid;
+	};
+
+	static constexpr uint32_t entryCount = 256; // Must match the shift of getSlot
+
+	[[nodiscard]] const Entry* lookup(uint32_t addressSpace, uint32_t segment, uint32_t page) const noexcept
+	{
+		const auto key = (segment << 9) | page;
+		const auto& entry = entries[getSlot(addressSpace, key)];
+		return entry.isValid && entry.addressSpace == addressSpace && entry.page == key ? &entry : nullptr;
+	}
+
+	void insert(uint32_t addressSpace, uint32_t segment, uint32_t page, int frame, int segmentSize) noexcept
+	{
+		const auto key = (segment << 9) | page;
+		entries[getSlot(addressSpace, key)] = Entry{addressSpace, key, frame, segmentSize, true};
+	}
+
+	void flush(uint32_t addressSpace) noexcept // Only needed when the mappings of a space change or its identifier is reused
+	{
+		for (auto& entry : entries)
+		{
+			if (entry.addressSpace == addressSpace) entry.isValid = false;
+		}
+	}
+
+	void flushAll() noexcept
+	{
+		for (auto& entry : entries) entry.isValid = false;
+	}
+
+private:
+	[[nodiscard]] static uint32_t getSlot(uint32_t addressSpace, uint32_t key) noexcept
+	{
+		return ((key ^ (addressSpace << 23)) * 0x9E3779B1u) >> 24; // Fibonacci hashing, the same page of two spaces lands in different slots
+	}
+
+	std::array<Entry, entryCount> entries{};
+};
@@ -1,11 +1,50 @@
 #include "MemoryManager.h"
 
+// project2 <init file> <va file> [--disk <image> | --disk-readonly <image>] [--disk-blocks <count>] [--snapshot-cache <directory>] [--threads <count>] [--large-segments <minimum pages>] [--page-tables <hierarchical | inverted>] [--profile <window>]
 int main(int argc, const char *const *const argv)
 {
 	auto arguments = std::vector<std::string_view>(argv, argv + argc);
+	if (arguments.size() < 3) throw std::runtime_error{"Missing input file name"};
 
-	auto memoryManager = MemoryManager{};
-	if (arguments.size() != 3) throw std::runtime_error{"Missing input file name"};
-	memoryManager.init(arguments[1]);
-	memoryManager.parseVirtualAddresses(arguments[2]);
+	auto diskImagePath = std::optional<std::filesystem::path>{};
+	auto diskMode = MappedFile::Mode::Shared;
+	auto diskBlocks = std::optional<uint32_t>{}; // An existing disk image has its own
+	auto snapshotCache = std::optional<std::filesystem::path>{};
+	auto threadCount = uint32_t{1};
+	auto largeSegmentPages = std::optional<uint32_t>{};
+	auto profileWindow = std::optional<uint64_t>{};
+	auto isInvertedPageTable = false;
+	for (size_t i = 3; i < arguments.size(); i++)
+	{
+		const auto option = arguments[i];
+		if (i + 1 == arguments.size()) throw std::runtime_error{"Missing value for an option."};
+		const auto value = arguments[++i];
+		if (option == "--disk") diskImagePath = value;
+		else if (option == "--disk-readonly")
+		{
+			diskImagePath = value;
+			diskMode = MappedFile::Mode::Private; // Share the image with other instances, never write it back
+		}
+		else if (option == "--disk-blocks") diskBlocks = static_cast<uint32_t>(std::stoul(std::string{value}));
+		else if (option == "--snapshot-cache") snapshotCache = value;
+		else if (option == "--threads") threadCount = static_cast<uint32_t>(std::stoul(std::string{value}));
+		else if (option == "--profile") profileWindow = std::max(1ULL, std::stoull(std::string{value})); // Written to profile.json next to output.txt
+		else if (option == "--large-segments") largeSegmentPages = std::max(1U, static_cast<uint32_t>(std::stoul(std::string{value})));
+		else if (option == "--page-tables")
+		{
+			if (value != "hierarchical" && value != "inverted") throw std::runtime_error{"Unknown page table mode."};
+			isInvertedPageTable = value == "inverted";
+		}
+		else throw std::runtime_error{"Unknown option."};
+	}
+	if (snapshotCache.has_value() && diskImagePath.has_value()) throw std::runtime_error{"--snapshot-cache can't be combined with a disk image."};
+
+	auto memoryManager = diskImagePath.has_value() ? MemoryManager{diskImagePath.value(), diskMode, diskBlocks} : MemoryManager{diskBlocks.value_or(MemoryManager::defaultDiskBlocks)};
+	if (snapshotCache.has_value()) memoryManager.initCached(arguments[1], snapshotCache.value());
+	else memoryManager.init(arguments[1]);
+	if (isInvertedPageTable) memoryManager.enableInvertedPageTable(); // After the init, a snapshot holds the PTs
+	if (profileWindow.has_value()) memoryManager.enableProfiling(profileWindow.value());
+	if (largeSegmentPages.has_value()) memoryManager.mapLargeSegments(largeSegmentPages.value());
+	memoryManager.parseVirtualAddresses(arguments[2], threadCount);
+	memoryManager.syncDisk();
 }
@@ -0,0 +1,339 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "MemoryManager.h"
+
+namespace
+{
+	[[nodiscard]] std::filesystem::path makeTestDirectory(std::string_view name) // Fresh directory for the files of one test
+	{
+		const auto directory = std::filesystem::temp_directory_path()/"project2Tests"/name;
+		std::filesystem::remove_all(directory);
+		std::filesystem::create_directories(directory);
+		return directory;
+	}
+
+	void writeFile(const std::filesystem::path& path, std::string_view content)
+	{
+		auto file = std::ofstream{path, std::ios::binary};
+		file << content;
+	}
+
+	[[nodiscard]] std::string readFile(const std::filesystem::path& path)
+	{
+		auto file = std::ifstream{path, std::ios::binary};
+		auto content = std::ostringstream{};
+		content << file.rdbuf();
+		return content.str();
+	}
+
+	[[nodiscard]] std::vector<int> translateAll(MemoryManager& memoryManager, const std::vector<uint32_t>& vas)
+	{
+		auto pas = std::vector<int>(vas.size());
+		memoryManager.translate(vas, pas);
+		return pas;
+	}
+
+	// Segment 0 has its PT on the disk and pages both resident and on the disk, segment 1 a resident PT with a page on the disk
+	constexpr auto faultingInit = std::string_view{"0 2000 -3 1 1000 4\n0 0 -10 0 1 11 0 2 -12 1 0 -13 1 1 14\n"};
+	const auto faultingVas = std::vector<uint32_t>{0, 600, 1100, 1500, 2000, 1999, (1 << 18) + 5, (1 << 18) + 700, (1 << 18) + 1000, 300, 1030};
+}
+
+TEST_CASE("parseVirtualAddresses() writes the profile of a run that exhausted the frames")
+{
+	const auto directory = makeTestDirectory("exhaustion");
+	writeFile(directory/"init.txt", "0 262144 2 1 262144 3 2 262144 4\n0 0 5 0 1 6\n"); // Three full segments, the other pages on the disk
+	auto vas = std::string{};
+	for (uint32_t segment = 0; segment < 3; segment++)
+	{
+		for (uint32_t page = 0; page < MemoryManager::frameSize; page++) vas += std::to_string((segment << 18) | (page << 9)) + ' '; // More pages than frames
+	}
+	writeFile(directory/"va.txt", vas);
+
+	auto memoryManager = MemoryManager{};
+	memoryManager.init(directory/"init.txt");
+	memoryManager.enableProfiling(100);
+	REQUIRE_THROWS_WITH(memoryManager.parseVirtualAddresses(directory/"va.txt"), "No free frame left.");
+	REQUIRE(std::filesystem::exists(directory/"profile.json"));
+	const auto profile = readFile(directory/"profile.json");
+	REQUIRE(profile.find("\"exhaustions\": 1") != std::string::npos);
+	REQUIRE(profile.find("\"remaining\": 0") != std::string::npos);
+}
+
+TEST_CASE("init() applies nothing from a malformed init file")
+{
+	const auto directory = makeTestDirectory("malformed");
+	writeFile(directory/"init.txt", "0 1000 2 1 1000 4\n0 0 3 1 0 6\n");
+	writeFile(directory/"segment.txt", "0 2000 2 1 2000 x\n0 0 3\n");
+	writeFile(directory/"page.txt", "1 2000 4\n1 0 x\n");
+	writeFile(directory/"format.txt", "1 2000 x 4\n1 0 6\n");
+	writeFile(directory/"range.txt", "1 2000 4\n1 0 99999999999999999999\n");
+
+	auto memoryManager = MemoryManager{};
+	memoryManager.init(directory/"init.txt");
+	const auto vas = std::array<uint32_t, 4>{0, 1500, 1 << 18, (1 << 18) + 1500}; // Page 0 of segments 0 and 1, then past their end
+	const auto expected = std::array<int, 4>{3 * 512, -1, 6 * 512, -1};
+	auto pas = std::array<int, 4>{};
+	memoryManager.translate(vas, pas);
+	REQUIRE(pas == expected);
+
+	REQUIRE_THROWS_AS(memoryManager.init(directory/"segment.txt"), std::invalid_argument);
+	REQUIRE_THROWS_AS(memoryManager.init(directory/"page.txt"), std::invalid_argument);
+	REQUIRE_THROWS_WITH(memoryManager.init(directory/"format.txt"), "Input command doesn't follow the required format."); // Before the invalid number
+	REQUIRE_THROWS_AS(memoryManager.init(directory/"range.txt"), std::out_of_range);
+	memoryManager.translate(vas, pas);
+	REQUIRE(pas == expected); // Neither the segments nor the pages before the malformed triple were applied
+}
+
+TEST_CASE("saveSnapshot()/restoreSnapshot() round trip")
+{
+	const auto directory = makeTestDirectory("snapshot");
+	writeFile(directory/"init.txt", faultingInit);
+
+	auto memoryManager = MemoryManager{};
+	memoryManager.init(directory/"init.txt");
+	memoryManager.saveSnapshot(directory/"init.snapshot");
+	const auto expected = translateAll(memoryManager, faultingVas);
+
+	auto restored = MemoryManager{};
+	restored.restoreSnapshot(directory/"init.snapshot");
+	REQUIRE(translateAll(restored, faultingVas) == expected); // The faults are resolved the same way from the restored state
+
+	// The second initCached() of the same file is served by the snapshot the first one wrote
+	auto cached = MemoryManager{};
+	cached.initCached(directory/"init.txt", directory/"cache");
+	REQUIRE(std::distance(std::filesystem::directory_iterator{directory/"cache"}, std::filesystem::directory_iterator{}) == 1);
+	auto fromCache = MemoryManager{};
+	fromCache.initCached(directory/"init.txt", directory/"cache");
+	REQUIRE(translateAll(fromCache, faultingVas) == expected);
+}
+
+TEST_CASE("restoreSnapshot() rejects a snapshot of another version or geometry")
+{
+	const auto directory = makeTestDirectory("snapshotHeader");
+	writeFile(directory/"init.txt", faultingInit);
+	auto memoryManager = MemoryManager{};
+	memoryManager.init(directory/"init.txt");
+	memoryManager.saveSnapshot(directory/"init.snapshot");
+	const auto snapshot = readFile(directory/"init.snapshot");
+	const auto patchField = [&](size_t offset, uint32_t value, const std::filesystem::path& path) // Header: magic[8], version, frameCount, frameSize, diskBlocks
+	{
+		auto patched = snapshot;
+		std::memcpy(patched.data() + offset, &value, sizeof(value));
+		writeFile(path, patched);
+	};
+	patchField(8, 1, directory/"version.snapshot");
+	patchField(12, MemoryManager::frameCount * 2, directory/"frameCount.snapshot");
+	patchField(16, MemoryManager::frameSize / 2, directory/"frameSize.snapshot");
+
+	auto fresh = MemoryManager{};
+	REQUIRE_THROWS_WITH(fresh.restoreSnapshot(directory/"version.snapshot"), "Unsupported snapshot version.");
+	REQUIRE_THROWS_WITH(fresh.restoreSnapshot(directory/"frameCount.snapshot"), "Snapshot geometry doesn't match the memory manager.");
+	REQUIRE_THROWS_WITH(fresh.restoreSnapshot(directory/"frameSize.snapshot"), "Snapshot geometry doesn't match the memory manager.");
+	writeFile(directory/"truncated.snapshot", snapshot.substr(0, 1000));
+	REQUIRE_THROWS_WITH(fresh.restoreSnapshot(directory/"truncated.snapshot"), "Snapshot is truncated.");
+	const auto expected = translateAll(memoryManager, faultingVas);
+	fresh.restoreSnapshot(directory/"init.snapshot"); // Still usable after the rejections
+	REQUIRE(translateAll(fresh, faultingVas) == expected);
+}
+
+TEST_CASE("translateConcurrent() matches translate()")
+{
+	const auto directory = makeTestDirectory("concurrent");
+	auto segments = std::string{"4 51200 -1000"}; // Segment 4 has its PT on the disk
+	auto pages = std::string{};
+	for (uint32_t segment = 0; segment < 4; segment++) segments += ' ' + std::to_string(segment) + " 262144 " + std::to_string(segment + 2);
+	for (uint32_t segment = 0; segment < 5; segment++)
+	{
+		for (uint32_t page = 0; page < 150; page++) pages += std::to_string(segment) + ' ' + std::to_string(page) + " -" + std::to_string(1 + (segment * 150 + page) % 999) + ' '; // Every page on the disk
+	}
+	writeFile(directory/"init.txt", segments + '\n' + pages + '\n');
+
+	auto vas = std::vector<uint32_t>(40000);
+	auto state = uint64_t{42};
+	for (auto& va : vas)
+	{
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		const auto segment = static_cast<uint32_t>(state >> 61) % 5;
+		const auto page = static_cast<uint32_t>(state >> 40) % 150; // Pages 100 and up of segment 4 are out of the segment
+		va = (segment << 18) | (page << 9) | static_cast<uint32_t>((state >> 20) & 0x1FF);
+	}
+
+	auto serial = MemoryManager{};
+	serial.init(directory/"init.txt");
+	const auto expected = translateAll(serial, vas);
+	REQUIRE(std::ranges::count(expected, -1) > 0);
+
+	auto concurrent = MemoryManager{};
+	concurrent.init(directory/"init.txt");
+	auto pas = std::vector<int>(vas.size());
+	concurrent.translateConcurrent(vas, pas, 4);
+	REQUIRE(pas == expected);
+	REQUIRE(translateAll(concurrent, vas) == expected); // The faults left the same mappings behind
+}
+
+TEST_CASE("mapLargeSegment() translates like the paged segment and falls back to paging")
+{
+	const auto directory = makeTestDirectory("largeSegment");
+	// Segment 0 (20 pages) has resident and disk pages, segment 1 (300 pages) is larger than any run left between frames 250, 500 and 750
+	writeFile(directory/"init.txt", "0 10000 2 1 153600 3\n0 0 10 0 1 -20 0 5 11 1 0 250 1 1 500 1 2 750\n");
+	auto vas = std::vector<uint32_t>{};
+	for (uint32_t pw = 0; pw < 10200; pw += 97) vas.push_back(pw);
+	const auto largeVas = std::vector<uint32_t>{(1 << 18) + 3, (1 << 18) + 600, (1 << 18) + 1100};
+
+	auto memoryManager = MemoryManager{};
+	memoryManager.init(directory/"init.txt");
+	const auto paged = translateAll(memoryManager, vas); // Also fills the TLB with the paged frames
+	const auto pagedLarge = translateAll(memoryManager, largeVas);
+	REQUIRE_FALSE(memoryManager.mapLargeSegment(1));
+	REQUIRE(translateAll(memoryManager, largeVas) == pagedLarge);
+
+	REQUIRE(memoryManager.mapLargeSegment(0));
+	REQUIRE_FALSE(memoryManager.mapLargeSegment(0)); // Already large
+	const auto large = translateAll(memoryManager, vas);
+	const auto runAddress = large.front(); // PA of pw 0, the run starts there
+	for (size_t i = 0; i < vas.size(); i++)
+	{
+		REQUIRE((large[i] == -1) == (paged[i] == -1));
+		if (large[i] != -1) REQUIRE(large[i] == runAddress + static_cast<int>(vas[i]));
+	}
+	REQUIRE(runAddress % static_cast<int>(MemoryManager::frameSize) == 0);
+	REQUIRE(std::ranges::count(large, -1) > 0);
+}
+
+TEST_CASE("Address spaces keep their own mappings and frames")
+{
+	const auto directory = makeTestDirectory("addressSpaces");
+	writeFile(directory/"init.txt", "5 4000 2\n5 5 -7 5 6 -8\n"); // Pages 0 and 1 aren't listed, so frames 0 and 1 aren't marked taken
+	writeFile(directory/"layout.txt", "5 4000 4\n5 5 9 5 6 -10\n");
+	constexpr auto page5 = (5u << 18) | (5u << 9) | 7u;
+	constexpr auto page6 = (5u << 18) | (6u << 9) | 7u;
+	constexpr auto pastSegment = (5u << 18) | 4000u;
+	const auto vas = std::vector<uint32_t>{page5, page6, pastSegment};
+	const auto isOutsideSegmentTable = [](int pa){ return pa >= static_cast<int>(MemoryManager::segmentTableFrames * MemoryManager::frameSize); };
+
+	auto memoryManager = MemoryManager{};
+	memoryManager.init(directory/"init.txt");
+	const auto layout = MemoryManager::loadLayout(directory/"layout.txt");
+	const auto addressSpace = memoryManager.createAddressSpace(layout);
+	REQUIRE(addressSpace == 1);
+	REQUIRE_THROWS_WITH(memoryManager.contextSwitch(2), "Invalid address space.");
+
+	// Faults of address space 1 come first and must not take the frames of address space 0's ST
+	memoryManager.contextSwitch(1);
+	REQUIRE(memoryManager.getActiveAddressSpace() == 1);
+	const auto pas1 = translateAll(memoryManager, vas);
+	REQUIRE(isOutsideSegmentTable(pas1[0]));
+	REQUIRE(isOutsideSegmentTable(pas1[1]));
+	REQUIRE(pas1[2] == -1);
+
+	memoryManager.contextSwitch(0);
+	const auto pas0 = translateAll(memoryManager, vas);
+	REQUIRE(isOutsideSegmentTable(pas0[0]));
+	REQUIRE(isOutsideSegmentTable(pas0[1]));
+	REQUIRE(pas0[2] == -1); // The size in address space 0's ST survived
+	REQUIRE(pas0[0] / 512 != pas1[0] / 512);
+	REQUIRE(pas0[1] / 512 != pas1[1] / 512);
+
+	// The TLB holds both spaces' entries for the same pages, tagged apart
+	memoryManager.contextSwitch(1);
+	REQUIRE(translateAll(memoryManager, vas) == pas1);
+	memoryManager.contextSwitch(0);
+	REQUIRE(translateAll(memoryManager, vas) == pas0);
+
+	REQUIRE_THROWS_WITH(memoryManager.destroyAddressSpace(0), "Address space 0 can't be destroyed.");
+	memoryManager.contextSwitch(1);
+	REQUIRE_THROWS_WITH(memoryManager.destroyAddressSpace(1), "Can't destroy the active address space.");
+	memoryManager.contextSwitch(0);
+	REQUIRE(memoryManager.destroyAddressSpace(1) == 5); // ST (2 frames), PT, page 5 and the faulted page 6
+	REQUIRE_THROWS_WITH(memoryManager.contextSwitch(1), "Invalid address space.");
+	REQUIRE_THROWS_WITH(memoryManager.destroyAddressSpace(1), "Invalid address space.");
+
+	// The identifier and the frames are handed out again, first fit gives the same frames
+	REQUIRE(memoryManager.createAddressSpace(layout) == 1);
+	memoryManager.contextSwitch(1);
+	REQUIRE(translateAll(memoryManager, vas) == pas1);
+	memoryManager.contextSwitch(0);
+	REQUIRE(translateAll(memoryManager, vas) == pas0);
+}
+
+TEST_CASE("Inverted page table translates like the page tables")
+{
+	const auto directory = makeTestDirectory("invertedPageTable");
+	writeFile(directory/"init.txt", faultingInit);
+	// Segment 0 moves to a fresh PT in frame 100: page 0 is remapped and pages 1 and 2 are back to block 1 (a PT word holding -1)
+	writeFile(directory/"reinit.txt", "0 2000 100\n0 0 20\n");
+
+	auto pageTables = MemoryManager{};
+	pageTables.init(directory/"init.txt");
+	auto folded = MemoryManager{};
+	folded.init(directory/"init.txt");
+	folded.enableInvertedPageTable();
+	auto foldedFirst = MemoryManager{};
+	foldedFirst.enableInvertedPageTable();
+	foldedFirst.init(directory/"init.txt");
+
+	// Freed PT frames may serve the faults, so the frames can differ but not the offsets nor the invalid addresses
+	const auto expected = translateAll(pageTables, faultingVas);
+	const auto foldedPas = translateAll(folded, faultingVas);
+	for (const auto& pas : {foldedPas, translateAll(foldedFirst, faultingVas)})
+	{
+		for (size_t i = 0; i < faultingVas.size(); i++)
+		{
+			REQUIRE((pas[i] == -1) == (expected[i] == -1));
+			if (pas[i] != -1) REQUIRE(pas[i] % 512 == static_cast<int>(faultingVas[i] % 512));
+		}
+		REQUIRE(pas[7] == expected[7]); // Page 1 of segment 1 was resident from the start
+	}
+
+	// The folded pages of a segment declared again are erased with its old PT, its pages fault again instead of keeping their frames
+	pageTables.init(directory/"reinit.txt");
+	folded.init(directory/"reinit.txt");
+	const auto reinitVas = std::vector<uint32_t>{5, 600, 1100}; // Pages 0, 1 and 2, faultingVas[1] and faultingVas[2] are the same words
+	const auto reinitPas = translateAll(folded, reinitVas);
+	REQUIRE(reinitPas[0] == 20 * 512 + 5);
+	REQUIRE(reinitPas[0] == translateAll(pageTables, reinitVas)[0]);
+	REQUIRE(reinitPas[1] != foldedPas[1]);
+	REQUIRE(reinitPas[2] != foldedPas[2]);
+	REQUIRE(reinitPas[1] % 512 == 600 % 512);
+	REQUIRE(reinitPas[2] % 512 == 1100 % 512);
+}
+
+TEST_CASE("destroyAddressSpace() frees the pages folded into the inverted page table")
+{
+	const auto directory = makeTestDirectory("invertedAddressSpaces");
+	writeFile(directory/"init.txt", "5 4000 2\n5 5 -7 5 6 -8\n");
+	writeFile(directory/"layout.txt", "5 4000 4\n5 5 9 5 6 -10\n");
+	constexpr auto page5 = (5u << 18) | (5u << 9) | 7u;
+	constexpr auto page6 = (5u << 18) | (6u << 9) | 7u;
+	const auto vas = std::vector<uint32_t>{page5, page6};
+
+	auto memoryManager = MemoryManager{};
+	memoryManager.enableInvertedPageTable();
+	memoryManager.init(directory/"init.txt");
+	const auto pas0 = translateAll(memoryManager, vas);
+	const auto layout = MemoryManager::loadLayout(directory/"layout.txt");
+	REQUIRE(memoryManager.createAddressSpace(layout) == 1);
+	memoryManager.contextSwitch(1);
+	const auto pas1 = translateAll(memoryManager, vas);
+	REQUIRE(pas1[0] / 512 != pas0[0] / 512);
+	REQUIRE(pas1[1] / 512 != pas0[1] / 512);
+
+	memoryManager.contextSwitch(0);
+	REQUIRE(memoryManager.destroyAddressSpace(1) == 4); // ST (2 frames), page 5 and the faulted page 6, the PT was folded
+	REQUIRE(translateAll(memoryManager, vas) == pas0);
+
+	// The identifier comes back without the mappings of its previous owner, its pages get the same frames by first fit
+	REQUIRE(memoryManager.createAddressSpace(layout) == 1);
+	memoryManager.contextSwitch(1);
+	REQUIRE(translateAll(memoryManager, vas) == pas1);
+	memoryManager.contextSwitch(0);
+	REQUIRE(memoryManager.destroyAddressSpace(1) == 4);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <filesystem>
+#include <list>
+#include <optional>
+
+// Glue between System and MemoryManager: every process owns an address space built from the init file,
+// a page fault blocks the running process on the disk queue until a disk interrupt ("io") brings the page in
+// Commands added to the shell:
+//	va <address>: translate a virtual address for the running process
+//	io: complete the disk I/O at the head of the disk queue and unblock its process
+//	in: reset the processes and the memory
+class Pager
+{
+public:
+	Pager(System& inSystem, MemoryManager& inMemory, std::filesystem::path inInitFilePath) :
+		system{inSystem}
+		, memory{inMemory}
+		, initFilePath{std::move(inInitFilePath)}
+		, layout{MemoryManager::loadLayout(initFilePath)}
+		, addressSpaces{}
+		, diskQueue{}
+	{
+		resetMemory();
+	}
+
+	void attach(Shell& shell)
+	{
+		system.setProcessHooks(
+			[this](ProcessID process){ addressSpaces[process] = memory.createAddressSpace(layout); }
+			, [this](ProcessID process){ releaseAddressSpace(process); }
+		);
+		shell.registerCommand("va", [this](System&, const std::vector<std::string>& arguments){ translate(arguments); });
+		shell.registerCommand("io", [this](System&, const std::vector<std::string>& arguments){ completeDiskIO(arguments); });
+		shell.registerCommand("in", [this](System&, const std::vector<std::string>& arguments){ init(arguments); });
+	}
+
+	void translate(const std::vector<std::string>& arguments)
+	{
+		checkArgumentSize(arguments, 1);
+		const auto va = toVirtualAddress(arguments.front());
+		const auto process = system.getRunningProcess();
+		memory.contextSwitch(addressSpaces[process].value());
+		if (process != 0 && memory.wouldFault(va)) // Process 0 never blocks, its faults are served right away
+		{
+			diskQueue.push_back({process, va});
+			system.blockRunningProcess();
+			return;
+		}
+		printTranslation(process, va);
+	}
+
+	void completeDiskIO(const std::vector<std::string>& arguments)
+	{
+		checkArgumentSize(arguments, 0);
+		if (diskQueue.empty()) throw std::runtime_error{"No disk I/O is pending."};
+		const auto [process, va] = diskQueue.front();
+		memory.contextSwitch(addressSpaces[process].value());
+		printTranslation(process, va); // Resolves the faults, throws and keeps the request queued if the memory is full
+		diskQueue.pop_front();
+		system.unblockProcess(process);
+	}
+
+	void init(const std::vector<std::string>& arguments)
+	{
+		system.init(arguments);
+		diskQueue.clear();
+		resetMemory();
+	}
+
+private:
+	void resetMemory() // Process 0 owns address space 0, initialized as in project2
+	{
+		memory = MemoryManager{};
+		memory.init(initFilePath);
+		addressSpaces = {};
+		addressSpaces[0] = 0;
+	}
+
+	void releaseAddressSpace(ProcessID process)
+	{
+		std::erase_if(diskQueue, [process](const auto& request){ return request.first == process; });
+		if (!addressSpaces[process].has_value() || addressSpaces[process].value() == 0) return;
+		memory.contextSwitch(0); // The active space can't be destroyed
+		const auto framesFreed = memory.destroyAddressSpace(addressSpaces[process].value());
+		addressSpaces[process] = std::nullopt;
+		std::cout << framesFreed << " frames of process " << process << " freed\n";
+	}
+
+	void printTranslation(ProcessID process, uint32_t va)
+	{
+		auto pa = std::array<int, 1>{};
+		memory.translate(std::array<uint32_t, 1>{va}, pa);
+		std::cout << "process " << process << " address " << va << " -> " << pa.front() << '\n';
+	}
+
+	[[nodiscard]] static uint32_t toVirtualAddress(std::string_view string)
+	{
+		auto va = uint32_t{0};
+		const auto [next, error] = std::from_chars(string.data(), string.data() + string.size(), va);
+		if (error != std::errc{} || next != string.data() + string.size()) throw std::runtime_error{"Invalid virtual address."};
+		return va;
+	}
+
+	System& system;
+	MemoryManager& memory;
+	std::filesystem::path initFilePath;
+	MemoryManager::AddressSpaceLayout layout; // Template of every process' address space
+	std::array<std::optional<AddressSpaceID>, ProcessID::MAX_EXCLUSIVE> addressSpaces;
+	std::list<std::pair<ProcessID, uint32_t>> diskQueue; // Processes blocked on a page fault, served in order like RCB::waitList
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A simulator kept alive behind the server, owned by one connection
+class Session
+{
+public:
+	virtual ~Session() = default;
+	virtual void runBatch(std::string_view batch, std::string& response) = 0; // Append the output of the batch to the response
+};
+
+// Long lived server on a Unix domain socket, so many short runs pay the process startup and the construction of the simulators once
+// Line based protocol:
+//	The first line of a connection opens its session (ie: "system"), answered by "ok" or by "error <reason>" before closing
+//	Then batches of commands, each ended by a line holding a single '.', answered by the output of the batch then a line holding a single '.'
+// Every connection is in one epoll instance in one shot mode and a small pool of threads waits on it,
+// so a session is only served by one thread at a time and needs no lock of its own
+class SessionServer
+{
+public:
+	using SessionFactory = std::function<std::unique_ptr<Session>(std::string_view openLine)>; // Throws to refuse the session
+
+	SessionServer(const std::filesystem::path& inSocketPath, SessionFactory inFactory) :
+		socketPath{inSocketPath}
+		, factory{std::move(inFactory)}
+		, listenFd{-1}
+		, epollFd{-1}
+		, stopFd{-1}
+		, connections{}
+	{
+		auto address = sockaddr_un{};
+		address.sun_family = AF_UNIX;
+		if (socketPath.native().size() >= sizeof(address.sun_path)) throw std::runtime_error{"Socket path is too long."};
+		std::strcpy(address.sun_path, socketPath.c_str());
+
+		listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+		stopFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (listenFd < 0 || epollFd < 0 || stopFd < 0)
+		{
+			closeAll();
+			throw std::runtime_error{"Failed to create the server."};
+		}
+		std::filesystem::remove(socketPath); // Left over by a previous server
+		if (::bind(listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listenFd, SOMAXCONN) != 0)
+		{
+			closeAll();
+			throw std::runtime_error{"Failed to listen on the socket."};
+		}
+		auto listenEvent = epoll_event{EPOLLIN | EPOLLONESHOT, {.ptr = nullptr}}; // nullptr tags the listening socket
+		auto stopEvent = epoll_event{EPOLLIN, {.ptr = this}}; // Level triggered, wakes every thread once stop() is called
+		if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent) != 0 || ::epoll_ctl(epollFd, EPOLL_CTL_ADD, stopFd, &stopEvent) != 0)
+		{
+			closeAll();
+			throw std::runtime_error{"Failed to register the socket."};
+		}
+	}
+
+	~SessionServer()
+	{
+		closeAll();
+	}
+
+	SessionServer(const SessionServer&) = delete;
+	SessionServer& operator=(const SessionServer&) = delete;
+
+	void run(uint32_t threadCount) // Blocks until stop()
+	{
+		auto threads = std::vector<std::jthread>{};
+		for (uint32_t thread = 1; thread < threadCount; thread++) threads.emplace_back([this]{ serve(); });
+		serve();
+	}
+
+	void stop() // Any thread
+	{
+		const auto one = uint64_t{1};
+		[[maybe_unused]] const auto written = ::write(stopFd, &one, sizeof(one));
+	}
+
+private:
+	struct Connection
+	{
+		int fd;
+		std::unique_ptr<Session> session; // Null until the first line
+		std::string input;
+		std::string output;
+		size_t written{0}; // Bytes of the output already sent
+		size_t scanned{0}; // Bytes of the pending batch already searched for its end
+		bool isClosing{false}; // Nothing more is read, close once the output is sent
+	};
+
+	static constexpr size_t readSize = 1 << 16;
+	static constexpr size_t maxBatchSize = 64 << 20; // A longer batch closes the connection, the input is never bigger
+
+	void serve()
+	{
+		auto events = std::array<epoll_event, 64>{};
+		auto buffer = std::vector<char>(readSize);
+		while (true)
+		{
+			const auto count = ::epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), -1);
+			if (count < 0 && errno == EINTR) continue;
+			if (count < 0) throw std::runtime_error{"Failed to wait for the sockets."};
+			for (int i = 0; i < count; i++)
+			{
+				const auto tag = events[i].data.ptr;
+				if (tag == this) return;
+				if (tag == nullptr) accept();
+				else serve(*static_cast<Connection*>(tag), buffer);
+			}
+		}
+	}
+
+	void accept()
+	{
+		while (true)
+		{
+			const auto fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) break; // EAGAIN, or the client is already gone
+			auto connection = std::make_unique<Connection>(Connection{.fd = fd, .session = nullptr, .input = {}, .output = {}});
+			auto event = epoll_event{EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, {.ptr = connection.get()}};
+			{
+				auto lock = std::lock_guard{mutex};
+				connections.emplace(fd, std::move(connection));
+			}
+			if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) close(fd);
+		}
+		auto listenEvent = epoll_event{EPOLLIN | EPOLLONESHOT, {.ptr = nullptr}};
+		::epoll_ctl(epollFd, EPOLL_CTL_MOD, listenFd, &listenEvent);
+	}
+
+	void serve(Connection& connection, std::vector<char>& buffer)
+	{
+		if (connection.output.empty() && !connection.isClosing) // Stop reading while the client doesn't read its responses
+		{
+			while (true)
+			{
+				const auto size = ::read(connection.fd, buffer.data(), buffer.size());
+				if (size > 0)
+				{
+					connection.input.append(buffer.data(), static_cast<size_t>(size));
+					if (connection.input.size() < readSize) continue;
+					runBatches(connection); // Every readSize bytes, so the input only holds the pending batch
+					if (connection.input.size() > maxBatchSize)
+					{
+						connection.output += "error Batch is too long.\n";
+						connection.isClosing = true;
+					}
+					if (!connection.output.empty() || connection.isClosing) break; // Send the responses before reading more
+				}
+				else if (size < 0 && errno == EINTR) continue;
+				else if (size < 0 && errno != EAGAIN) return close(connection.fd);
+				else
+				{
+					runBatches(connection);
+					if (size == 0) connection.isClosing = true; // The client is done sending, answer what came before
+					break;
+				}
+			}
+		}
+		if (!flush(connection)) return close(connection.fd);
+		const auto isWaitingForClient = !connection.output.empty();
+		if (connection.isClosing && !isWaitingForClient) return close(connection.fd);
+
+		auto event = epoll_event{(isWaitingForClient ? EPOLLOUT : EPOLLIN | EPOLLRDHUP) | EPOLLONESHOT, {.ptr = &connection}};
+		if (::epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event) != 0) close(connection.fd);
+	}
+
+	void runBatches(Connection& connection) // Every complete line or batch of the input
+	{
+		auto consumed = size_t{0};
+		const auto input = std::string_view{connection.input};
+		while (!connection.isClosing)
+		{
+			if (!connection.session)
+			{
+				const auto lineEnd = input.find('\n', consumed);
+				if (lineEnd == std::string_view::npos) break;
+				auto line = input.substr(consumed, lineEnd - consumed);
+				if (line.ends_with('\r')) line.remove_suffix(1);
+				consumed = lineEnd + 1;
+				try
+				{
+					connection.session = factory(line);
+					connection.output += "ok\n";
+				}
+				catch (const std::exception& error)
+				{
+					connection.output.append("error ").append(error.what()).append("\n");
+					connection.isClosing = true;
+				}
+				continue;
+			}
+			const auto batchEnd = findBatchEnd(input, consumed, connection.scanned);
+			if (batchEnd == std::string_view::npos) break;
+			connection.scanned = 0;
+			try
+			{
+				connection.session->runBatch(input.substr(consumed, batchEnd - consumed), connection.output);
+			}
+			catch (const std::exception& error)
+			{
+				connection.output.append("error ").append(error.what()).append("\n");
+			}
+			connection.output += ".\n";
+			consumed = input.find('\n', batchEnd) + 1;
+		}
+		connection.input.erase(0, consumed);
+	}
+
+	// Start of the line holding a single '.', npos if it isn't there yet. The complete lines searched are kept in scanned, starting from begin
+	[[nodiscard]] static size_t findBatchEnd(std::string_view input, size_t begin, size_t& scanned)
+	{
+		auto lineBegin = begin + scanned;
+		while (lineBegin < input.size())
+		{
+			const auto lineEnd = input.find('\n', lineBegin);
+			if (lineEnd == std::string_view::npos) break;
+			const auto line = input.substr(lineBegin, lineEnd - lineBegin);
+			if (line == "." || line == ".\r") return lineBegin;
+			lineBegin = lineEnd + 1;
+		}
+		scanned = lineBegin - begin;
+		return std::string_view::npos;
+	}
+
+	[[nodiscard]] static bool flush(Connection& connection) // False if the client is gone
+	{
+		while (connection.written < connection.output.size())
+		{
+			const auto size = ::send(connection.fd, connection.output.data() + connection.written, connection.output.size() - connection.written, MSG_NOSIGNAL);
+			if (size >= 0) connection.written += static_cast<size_t>(size);
+			else if (errno == EINTR) continue;
+			else return errno == EAGAIN;
+		}
+		connection.output.clear();
+		connection.written = 0;
+		return true;
+	}
+
+	void close(int fd) // Only by the thread holding the connection, closing also removes it from the epoll instance
+	{
+		auto connection = std::unique_ptr<Connection>{};
+		{
+			auto lock = std::lock_guard{mutex}; // The descriptor may be handed out again as soon as it is closed, accept() must not see it in the map
+			auto node = connections.extract(fd);
+			::close(fd);
+			connection = std::move(node.mapped());
+		}
+		// The session is destroyed out of the lock
+	}
+
+	void closeAll() noexcept
+	{
+		for (const auto& [fd, connection] : connections) ::close(fd);
+		connections.clear();
+		for (const auto fd : {listenFd, epollFd, stopFd})
+		{
+			if (fd >= 0) ::close(fd);
+		}
+		if (listenFd >= 0) ::unlink(socketPath.c_str());
+	}
+
+	std::filesystem::path socketPath;
+	SessionFactory factory;
+	int listenFd;
+	int epollFd;
+	int stopFd;
+	std::mutex mutex; // Guards the map only, a connection itself belongs to the thread that got its event
+	std::unordered_map<int, std::unique_ptr<Connection>> connections;
+};
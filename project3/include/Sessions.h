@@ -0,0 +1,121 @@
+#pragma once
+
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SessionServer.h"
+
+// Sessions served by the daemon mode, opened by:
+//	system: a System driven like "project1 -", a batch answers the running processes like output.txt
+//	memory <init file>: a MemoryManager initialized from the file, a batch of VAs answers their PAs like output.txt of project2
+
+class SystemSession : public Session
+{
+public:
+	SystemSession() :
+		system{System::makeSession()}
+		, shell{Shell::makeSession()}
+	{}
+
+	void runBatch(std::string_view batch, std::string& response) override
+	{
+		auto input = std::istringstream{std::string{batch}};
+		auto output = std::ostringstream{};
+		shell.run(system, input, output);
+		response += output.view();
+	}
+
+private:
+	System system;
+	Shell shell;
+};
+
+class MemoryManagerPool // Managers of closed sessions are reset and handed to the next ones instead of building new ones
+{
+public:
+	static constexpr size_t capacity = 64; // Idle managers kept, 4 MiB each
+
+	[[nodiscard]] std::unique_ptr<MemoryManager> acquire()
+	{
+		{
+			auto lock = std::lock_guard{mutex};
+			if (!idle.empty())
+			{
+				auto manager = std::move(idle.back());
+				idle.pop_back();
+				return manager;
+			}
+		}
+		return std::make_unique<MemoryManager>();
+	}
+
+	void release(std::unique_ptr<MemoryManager> manager)
+	{
+		manager->reset(); // Out of the lock
+		auto lock = std::lock_guard{mutex};
+		if (idle.size() < capacity) idle.push_back(std::move(manager));
+	}
+
+private:
+	std::mutex mutex;
+	std::vector<std::unique_ptr<MemoryManager>> idle;
+};
+
+class MemorySession : public Session
+{
+public:
+	MemorySession(MemoryManagerPool& inPool, const std::filesystem::path& initFilePath) :
+		pool{inPool}
+		, manager{inPool.acquire()}
+	{
+		try { manager->init(initFilePath); }
+		catch (...)
+		{
+			pool.release(std::move(manager));
+			throw;
+		}
+	}
+
+	~MemorySession() override
+	{
+		if (manager) pool.release(std::move(manager));
+	}
+
+	MemorySession(const MemorySession&) = delete;
+	MemorySession& operator=(const MemorySession&) = delete;
+
+	void runBatch(std::string_view batch, std::string& response) override
+	{
+		const auto vas = MemoryManager::parseVirtualAddressChunk(batch.data(), batch.data() + batch.size());
+		auto pas = std::vector<int>(vas.size());
+		manager->translate(vas, pas);
+		auto formatted = std::array<char, 12>{}; // "-2147483648 "
+		for (const auto pa : pas)
+		{
+			const auto end = std::to_chars(formatted.data(), formatted.data() + formatted.size(), pa).ptr;
+			*end = ' ';
+			response.append(formatted.data(), end + 1);
+		}
+		response += '\n';
+	}
+
+private:
+	MemoryManagerPool& pool;
+	std::unique_ptr<MemoryManager> manager;
+};
+
+[[nodiscard]] inline std::unique_ptr<Session> makeSession(std::string_view openLine, MemoryManagerPool& pool)
+{
+	auto tokens = std::istringstream{std::string{openLine}};
+	auto kind = std::string{};
+	auto argument = std::string{};
+	tokens >> kind >> argument;
+	if (kind == "system" && argument.empty()) return std::make_unique<SystemSession>();
+	if (kind == "memory" && !argument.empty()) return std::make_unique<MemorySession>(pool, argument);
+	throw std::runtime_error{"Unknown session, expected \"system\" or \"memory <init file>\"."};
+}
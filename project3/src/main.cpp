@@ -0,0 +1,48 @@
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <functional>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+
+// g++ -std=c++20 -I../project1/include -I../project2/include -Iinclude
+
+#include "Predefined.h"
+#include "PCB.h"
+#include "RCB.h"
+#include "OutputSink.h"
+#include "System.h"
+#include "ReplayCache.h"
+#include "Shell.h"
+#include "MemoryManager.h"
+#include "Pager.h"
+#include "Sessions.h"
+
+// project3 <init file> [input file]
+// project3 --serve <socket> [--threads <count>], daemon serving "system" and "memory <init file>" sessions, see SessionServer.h
+int main(int argc, const char *const *const argv)
+{
+	auto arguments = std::vector<std::string_view>(argv, argv + argc);
+	if (arguments.size() >= 3 && arguments[1] == "--serve")
+	{
+		auto threadCount = std::max(1U, std::thread::hardware_concurrency());
+		if (arguments.size() == 5 && arguments[3] == "--threads") threadCount = std::max(1U, static_cast<uint32_t>(std::stoul(std::string{arguments[4]})));
+		else if (arguments.size() != 3) throw std::runtime_error{"Unknown option."};
+		auto pool = MemoryManagerPool{};
+		auto server = SessionServer{arguments[2], [&pool](std::string_view openLine){ return makeSession(openLine, pool); }};
+		server.run(threadCount);
+		return 0;
+	}
+	if (arguments.size() < 2 || arguments.size() > 3) throw std::runtime_error{"An init file and optionally an input file are needed."};
+
+	auto system = System::getInstance();
+	auto shell = Shell::getInstance();
+	auto memoryManager = MemoryManager{};
+	auto pager = Pager{system, memoryManager, arguments[1]};
+	pager.attach(shell);
+
+	if (arguments.size() == 2) shell.run(system);
+	else shell.run(system, arguments[2]);
+}
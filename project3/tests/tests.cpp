@@ -0,0 +1,181 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Predefined.h"
+#include "PCB.h"
+#include "RCB.h"
+#include "OutputSink.h"
+#include "System.h"
+#include "ReplayCache.h"
+#include "Shell.h"
+#include "MemoryManager.h"
+#include "Pager.h"
+#include "Sessions.h"
+
+namespace
+{
+	[[nodiscard]] std::filesystem::path makeTestDirectory(std::string_view name) // Fresh directory for the files of one test
+	{
+		const auto directory = std::filesystem::temp_directory_path()/"project3Tests"/name;
+		std::filesystem::remove_all(directory);
+		std::filesystem::create_directories(directory);
+		return directory;
+	}
+
+	void writeFile(const std::filesystem::path& path, std::string_view content)
+	{
+		auto file = std::ofstream{path, std::ios::binary};
+		file << content;
+	}
+
+	[[nodiscard]] std::string runPager(std::string_view init, std::string_view trace) // What the pager printed on std::cout
+	{
+		const auto directory = makeTestDirectory("pager");
+		writeFile(directory/"init.txt", init);
+		auto system = System::makeSession();
+		auto shell = Shell::makeSession();
+		auto memoryManager = MemoryManager{};
+		auto pager = Pager{system, memoryManager, directory/"init.txt"};
+		pager.attach(shell);
+
+		auto printed = std::ostringstream{};
+		auto* previousBuffer = std::cout.rdbuf(printed.rdbuf());
+		auto input = std::istringstream{std::string{trace}};
+		auto output = std::ostringstream{};
+		shell.run(system, input, output);
+		std::cout.rdbuf(previousBuffer);
+		return printed.str();
+	}
+
+	// Sends the whole request then reads the responses until the server closes the connection
+	[[nodiscard]] std::string sendRequest(const std::filesystem::path& socketPath, std::string_view request)
+	{
+		auto address = sockaddr_un{};
+		address.sun_family = AF_UNIX;
+		std::strcpy(address.sun_path, socketPath.c_str());
+		const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		REQUIRE(fd >= 0);
+		REQUIRE(::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0);
+
+		auto response = std::string{};
+		auto reader = std::jthread{[fd, &response]
+		{
+			auto buffer = std::array<char, 4096>{};
+			for (auto size = ::read(fd, buffer.data(), buffer.size()); size > 0; size = ::read(fd, buffer.data(), buffer.size()))
+			{
+				response.append(buffer.data(), static_cast<size_t>(size));
+			}
+		}};
+		for (auto sent = size_t{0}; sent < request.size();)
+		{
+			const auto size = ::send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+			if (size <= 0) break;
+			sent += static_cast<size_t>(size);
+		}
+		::shutdown(fd, SHUT_WR);
+		reader.join();
+		::close(fd);
+		return response;
+	}
+
+	class ByteCountSession : public Session // Answers the size of every batch
+	{
+	public:
+		void runBatch(std::string_view batch, std::string& response) override
+		{
+			response += std::to_string(batch.size()) + "\n";
+		}
+	};
+
+	class ServerThread // Runs the server until the end of the scope, even when a REQUIRE throws
+	{
+	public:
+		explicit ServerThread(SessionServer& inServer) :
+			server{inServer}
+			, thread{[this]{ server.run(2); }}
+		{}
+
+		~ServerThread()
+		{
+			server.stop();
+		}
+
+	private:
+		SessionServer& server;
+		std::jthread thread;
+	};
+
+	[[nodiscard]] std::unique_ptr<Session> makeTestSession(std::string_view openLine, MemoryManagerPool& pool)
+	{
+		if (openLine == "count") return std::make_unique<ByteCountSession>();
+		return makeSession(openLine, pool);
+	}
+}
+
+TEST_CASE("Pager keeps process 0's segment table when a process comes and goes")
+{
+	// Without other processes, process 0 translates VA 0 through its page at frame 4
+	REQUIRE(runPager("0 900 2\n0 0 4 5 1 -9\n", "va 0\n") == "process 0 address 0 -> 2048\n");
+	// The page of segment 5 isn't in a declared segment, it must not be written into the new ST. The frames of the new space never
+	// come from address space 0's ST
+	REQUIRE(runPager("0 900 2\n0 0 4 5 1 -9\n", "cr 1\nde 1\nva 0\n") == "4 frames of process 1 freed\nprocess 0 address 0 -> 2048\n");
+	REQUIRE(runPager("6 3000 4\n6 5 9\n", "cr 1\nde 1\nva 1575424\n") == "4 frames of process 1 freed\nprocess 0 address 1575424 -> 4608\n");
+}
+
+TEST_CASE("Pager gives every process its own pages")
+{
+	const auto printed = runPager("6 3000 4\n6 5 9\n", "cr 1\nva 1575424\nde 1\nva 1575424\n");
+	REQUIRE(printed.starts_with("process 1 address 1575424 -> "));
+	REQUIRE(printed.find("process 1 address 1575424 -> 4608") == std::string::npos); // Its own copy of the page
+	REQUIRE(printed.ends_with("process 0 address 1575424 -> 4608\n"));
+}
+
+TEST_CASE("SessionServer round trip")
+{
+	const auto socketPath = makeTestDirectory("server")/"socket";
+	auto pool = MemoryManagerPool{};
+	auto server = SessionServer{socketPath, [&pool](std::string_view openLine){ return makeTestSession(openLine, pool); }};
+	const auto serverThread = ServerThread{server};
+
+	SECTION("A session answers every batch followed by '.'")
+	{
+		REQUIRE(sendRequest(socketPath, "system\ncr 1\n.\nto\n.\n") == "ok\n1\n.\n1\n.\n");
+	}
+	SECTION("An unknown session is refused")
+	{
+		REQUIRE(sendRequest(socketPath, "unknown\ncr 1\n.\n").starts_with("error "));
+	}
+	SECTION("Batches longer than a read are answered")
+	{
+		auto request = std::string{"count\n"};
+		auto expected = std::string{"ok\n"};
+		for (const auto lineCount : {1, 10000, 200000, 3})
+		{
+			const auto batchSize = request.size();
+			for (int line = 0; line < lineCount; line++) request += "0123456\n";
+			expected += std::to_string(request.size() - batchSize) + "\n.\n";
+			request += ".\n";
+		}
+		REQUIRE(sendRequest(socketPath, request) == expected);
+	}
+	SECTION("A batch without end is refused once it is too long")
+	{
+		auto request = std::string{"count\n"};
+		request.append(size_t{80} << 20, '0'); // The server holds at most 64 MiB of a batch
+		REQUIRE(sendRequest(socketPath, request) == "ok\nerror Batch is too long.\n");
+	}
+
+}